@@ -0,0 +1,41 @@
+//	ffextensions.h - FFMpeg Input Driver Plugin for Virtual Dub, interfaces for host tools;
+//	Copyright (C) 2011 Andrey Kovalchuk
+
+//	This software is provided 'as-is', without any express or implied
+//	warranty.  In no event will the authors be held liable for any
+//	damages arising from the use of this software.
+//
+//	Permission is granted to anyone to use this software for any purpose,
+//	including commercial applications, and to alter it and redistribute it
+//	freely, subject to the following restrictions:
+//
+//	1.	The origin of this software must not be misrepresented; you must
+//		not claim that you wrote the original software. If you use this
+//		software in a product, an acknowledgment in the product
+//		documentation would be appreciated but is not required.
+//	2.	Altered source versions must be plainly marked as such, and must
+//		not be misrepresented as being the original software.
+//	3.	This notice may not be removed or altered from any source
+//		distribution.
+
+#ifndef f_FFINPUTDRIVER_FFEXTENSIONS_H
+#define f_FFINPUTDRIVER_FFEXTENSIONS_H
+
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include <vd2/plugin/vdinputdriver.h>
+
+//Thumbnails of many positions at once, query video source by AsInterface;
+class IVDFFThumbnailExtractor : public IVDXUnknown {
+public:
+	enum { kIID = VDXMAKEFOURCC('F', 'F', 't', 'h') };
+
+	//Keyframes nearest to pTimes (microseconds) scaled to width x height XRGB8888,
+	//thumbnail i starts at (uint8*)pBuffer + i*height*pitch, failed thumbnail is left black;
+	//pExtracted (count entries, may be NULL) tells which were extracted; returns count of extracted thumbnails;
+	virtual int	VDXAPIENTRY ExtractThumbnails(const sint64 *pTimes, int count, int width, int height, void *pBuffer, ptrdiff_t pitch, bool *pExtracted) = 0;
+};
+
+#endif
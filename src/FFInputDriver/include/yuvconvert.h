@@ -0,0 +1,73 @@
+//	yuvconvert.h - FFMpeg Input Driver Plugin for Virtual Dub, unscaled YUV kernels;
+//	Copyright (C) 2011 Andrey Kovalchuk
+
+//	This software is provided 'as-is', without any express or implied
+//	warranty.  In no event will the authors be held liable for any
+//	damages arising from the use of this software.
+//
+//	Permission is granted to anyone to use this software for any purpose,
+//	including commercial applications, and to alter it and redistribute it
+//	freely, subject to the following restrictions:
+//
+//	1.	The origin of this software must not be misrepresented; you must
+//		not claim that you wrote the original software. If you use this
+//		software in a product, an acknowledgment in the product
+//		documentation would be appreciated but is not required.
+//	2.	Altered source versions must be plainly marked as such, and must
+//		not be misrepresented as being the original software.
+//	3.	This notice may not be removed or altered from any source
+//		distribution.
+
+#ifndef f_FFINPUTDRIVER_YUVCONVERT_H
+#define f_FFINPUTDRIVER_YUVCONVERT_H
+
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include <stddef.h>
+#include <vd2/plugin/vdplugin.h>
+
+enum VDFFYUVLayout
+{
+	//Separate U and V planes;
+	kVDFFLayout_YUV420P = 0,
+	//Interleaved UV plane;
+	kVDFFLayout_NV12,
+};
+
+enum VDFFYUVMatrix
+{
+	kVDFFMatrix_BT601 = 0,
+	kVDFFMatrix_BT709,
+};
+
+//4:2:0 source, pU holds interleaved UV in NV12 layout;
+struct VDFFYUVPlanes
+{
+	const uint8*	pY;
+	const uint8*	pU;
+	const uint8*	pV;
+	ptrdiff_t		pitchY;
+	ptrdiff_t		pitchUV;
+};
+
+//Unscaled conversion to XRGB8888 (bytesPerPixel 4) or RGB888 (3) with kernel chosen by CPU,
+//fails if CPU has no kernel for output, swscale should be used then;
+bool	VDFFConvertYUVToRGB( const VDFFYUVPlanes& src, int layout, int matrix, bool bFullRange,
+			int w, int h, void* pDst, ptrdiff_t pitchDst, int bytesPerPixel );
+
+//Plain C version of same conversion, kernels match it bit by bit;
+void	VDFFConvertYUVToRGBReference( const VDFFYUVPlanes& src, int layout, int matrix, bool bFullRange,
+			int w, int h, void* pDst, ptrdiff_t pitchDst, int bytesPerPixel );
+
+//Unscaled reduction of plane with 9 to 16 bit little-endian samples to 8 bits,
+//rounding by ordered 8x8 dither; kernel chosen by CPU, plain C if there is none;
+void	VDFFReducePlane( const uint8* pSrc, ptrdiff_t pitchSrc, int bits,
+			int w, int h, uint8* pDst, ptrdiff_t pitchDst );
+
+//Plain C version of same reduction, kernels match it bit by bit;
+void	VDFFReducePlaneReference( const uint8* pSrc, ptrdiff_t pitchSrc, int bits,
+			int w, int h, uint8* pDst, ptrdiff_t pitchDst );
+
+#endif
@@ -25,6 +25,19 @@
 #define IDC_STARTTIME                   1068
 #define IDC_STREAMSCOUNT                1069
 #define IDC_BITRATE                     1071
+#define IDC_VIDEO_TIMECODES             1072
+#define IDC_VIDEO_KEYFRAMESONLY         1073
+#define IDC_VIDEO_LOWRES                1074
+#define IDC_VIDEO_DRAFTDECODE           1075
+#define IDC_VIDEO_DECODEAHEAD           1076
+#define IDC_VIDEO_PARALLELDECODE        1077
+#define IDC_VIDEO_DECODERPOOL           1078
+#define IDC_VIDEO_DUPLICATES            1079
+#define IDC_VIDEO_ALIGNEDROWS           1080
+#define IDC_VIDEO_ACCURATERND           1081
+#define IDC_VIDEO_FUSEDCONVERT          1084
+#define IDC_VIDEO_PREVIEWSCALER         1082
+#define IDC_VIDEO_EXPORTSCALER          1083
 #define IDC_AUDIO_BITRATE               1404
 
 // Next default values for new objects
@@ -33,7 +46,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        104
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1012
+#define _APS_NEXT_CONTROL_VALUE         1085
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
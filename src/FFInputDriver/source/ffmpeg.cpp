@@ -43,10 +43,15 @@ extern "C" {
 #include <string.h>
 #include <math.h>
 #include "resource.h"
+#include "ffextensions.h"
+#include "yuvconvert.h"
 #include <vd2/VDXFrame/Unknown.h>
 #include <vd2/VDXFrame/VideoFilterDialog.h>
 
 #include <list>
+#include <set>
+#include <algorithm>
+#include <process.h>
 
 
 #define INPUT_DRIVER_TAG  "[FFMpeg]"
@@ -61,6 +66,50 @@ extern "C" {
 #define MAX_PACKETS_DELTA		50
 #define MAX_DESYNC_TIME			0.1 //(sec)
 
+//Draft decode is used for scrubbing, sequential reads (playback, export),
+//repeated reads and reads after idle pause switch it off;
+#define DRAFT_IDLE_TIME			500 //(msec)
+
+//Frames decoded ahead of sequential reads (playback, export);
+#define MAX_DECODE_AHEAD		8
+
+//Following segments between keyframes decoded concurrently by own decoders;
+#define MAX_PARALLEL_DECODERS	4
+#define PARALLEL_MIN_SEGMENT	16
+#define PARALLEL_MEMORY_BUDGET	(256 << 20)
+
+//Extra decoders kept at other positions for random access;
+#define DECODER_POOL_SIZE		2
+//Targets in a row leaving random access to source decoder;
+#define POOL_SEQUENTIAL_FRAMES	8
+//Seek cost estimate in decoded frames (until measured);
+#define DECODER_SEEK_COST		8
+//Smoothing of measured decode and seek times;
+#define DECODE_COST_WEIGHT		8
+
+//Packets kept over decoder delay of reordered frames (delay grows while decoding);
+#define REORDER_DELAY_MARGIN	4
+
+//Scaler contexts kept per stream;
+#define MAX_SCALER_CONTEXTS		8
+//Memory of converted frames kept for repaints;
+#define OUTPUT_CACHE_MEMORY		(64 << 20)
+//Frames promised by Read and not taken by DecodeFrame yet (pipeline depth);
+#define OUTPUT_CACHE_PINNED		32
+//Targets in a row taken for playback or export, such frames aren't asked again;
+#define OUTPUT_CACHE_SEQUENTIAL	8
+
+//Color conversion bands (threads), rows of band and rows shared with neighbours;
+#define MAX_CONVERT_THREADS		8
+#define CONVERT_MIN_BAND		64
+#define CONVERT_BAND_OVERLAP	8
+
+//Tiny delta frame is possible repeat of preceding one (ratio to average packet size);
+#define DUPLICATE_PACKET_RATIO	64
+
+//Alignment of output rows and planes in aligned rows mode (cache line, 2 AVX registers);
+#define OUTPUT_ALIGN			64
+
 class VDFFOptions;
 
 class IFFStream;
@@ -74,6 +123,20 @@ public:
 	virtual bool readFrame( IFFStream* pStream ) = 0;
 	virtual bool seekFrame(  IFFStream* pStream, int64 timestamp, bool backward = true ) = 0;
 
+	//Demuxer and decoders are shared between streams and decode-ahead thread;
+	virtual void lock( void ) = 0;
+	virtual void unlock( void ) = 0;
+
+};
+
+class VDFFAutoLock
+{
+public:
+	VDFFAutoLock( IFFSource* pSource ): m_pSource( pSource ) { m_pSource->lock(); }
+	~VDFFAutoLock() { m_pSource->unlock(); }
+
+private:
+	IFFSource*		m_pSource;
 };
 
 class IFFStream
@@ -207,581 +270,3379 @@ private:
 ///////////////////////////////////////////////////////////////////////////////
 class VDFFOptions
 {
+public:
+	enum
+	{
+		//Constant r_frame_rate;
+		kTimecodesNone = 0,
+		//Frames mapped through packets timestamps;
+		kTimecodesFrame,
+	};
+
+	enum
+	{
+		kScalerFastBilinear = 0,
+		kScalerBilinear,
+		kScalerBicubic,
+		kScalerLanczos,
+	};
+
 public:
 	VDFFOptions():
 	  bAdjustPAR( 1 ),
-		  bAudioDownmix(1) {}
+		  bAudioDownmix(1),
+		  bTimecodes( kTimecodesFrame ),
+		  bKeyframesOnly( 0 ),
+		  bLowres( 0 ),
+		  bDraftDecode( 0 ),
+		  bDecodeAhead( 0 ),
+		  bParallelDecode( 0 ),
+		  bDecoderPool( 0 ),
+		  bDuplicates( 0 ),
+		  bAlignedRows( 0 ),
+		  bPreviewScaler( kScalerFastBilinear ),
+		  bExportScaler( kScalerLanczos ),
+		  bAccurateRnd( 0 ),
+		  bFusedConvert( 0 ) {}
 
 	  byte		bAdjustPAR;
 	  byte		bAudioDownmix;
+	  byte		bTimecodes;
+	  byte		bKeyframesOnly;
+	  //Preview scale: 1/(2^bLowres);
+	  byte		bLowres;
+	  //Skip loop filter and non-reference IDCT while scrubbing;
+	  byte		bDraftDecode;
+	  //Decode following frames on separate thread;
+	  byte		bDecodeAhead;
+	  //Decode several segments between keyframes at once;
+	  byte		bParallelDecode;
+	  //Keep extra decoders at recently used positions;
+	  byte		bDecoderPool;
+	  //Report repeated frames as null frames;
+	  byte		bDuplicates;
+	  //Pad rows and planes of output to OUTPUT_ALIGN;
+	  byte		bAlignedRows;
+	  //Scaler algorithm for scrubbing previews and for final (playback, export, settled) frames;
+	  byte		bPreviewScaler;
+	  byte		bExportScaler;
+	  byte		bAccurateRnd;
+	  //Convert frames decoded ahead on decode thread;
+	  byte		bFusedConvert;
 
 };
 ///////////////////////////////////////////////////////////////////////////////
-
-class VDFFVideoSource : public vdxunknown<IVDXStreamSource>, public IVDXVideoSource, public IVDXVideoDecoder, public IVDXVideoDecoderModel, public VDFFStreamBase 
+//Per-stream table of frame timestamps for variable frame rate sources;
+class VDFFTimecodes
 {
 public:
-	VDFFVideoSource(const VDXInputDriverContext& context);
-	~VDFFVideoSource();
-
-	int VDXAPIENTRY AddRef();
-	int VDXAPIENTRY Release();
-	void *VDXAPIENTRY AsInterface(uint32 iid);
+	void	clear( void ) { m_pts.clear(); }
+	bool	empty( void ) const { return m_pts.empty(); }
+	sint64	size( void ) const { return (sint64)m_pts.size(); }
 
-public:
-	//Stream Interface
-	void		VDXAPIENTRY GetStreamSourceInfo(VDXStreamSourceInfo&);
-	bool		VDXAPIENTRY Read(sint64 lStart, uint32 lCount, void *lpBuffer, uint32 cbBuffer, uint32 *lBytesRead, uint32 *lSamplesRead);
+	//Load timestamps (relative to first frame) from demuxer index,
+	//fails if index holds keyframes only or doesn't cover duration;
+	bool	loadIndex( AVStream* pStream, int64 duration );
 
-	const void *VDXAPIENTRY GetDirectFormat();
-	int			VDXAPIENTRY GetDirectFormatLen();
+	//Average frame duration (in stream timebase);
+	double	getFrameDuration( void ) const;
 
-	ErrorMode VDXAPIENTRY GetDecodeErrorMode();
-	void VDXAPIENTRY SetDecodeErrorMode(ErrorMode mode);
-	bool VDXAPIENTRY IsDecodeErrorModeSupported(ErrorMode mode);
+	int64	pos2ts( sint64 pos ) const;
+	sint64	ts2pos( int64 ts ) const;
 
-	bool VDXAPIENTRY IsVBR();
-	sint64 VDXAPIENTRY TimeToPositionVBR(sint64 us);
-	sint64 VDXAPIENTRY PositionToTimeVBR(sint64 samples);
+protected:
+	void	finalize( void );
 
-	void VDXAPIENTRY GetVideoSourceInfo(VDXVideoSourceInfo& info);
+	std::vector<int64>		m_pts;
+};
 
-	bool VDXAPIENTRY CreateVideoDecoderModel(IVDXVideoDecoderModel **ppModel);
-	bool VDXAPIENTRY CreateVideoDecoder(IVDXVideoDecoder **ppDecoder);
+bool VDFFTimecodes::loadIndex( AVStream* pStream, int64 duration )
+{
+	clear();
 
-	void		VDXAPIENTRY GetSampleInfo(sint64 sample_num, VDXVideoFrameInfo& frameInfo);
+	if ( !pStream || pStream->nb_index_entries < 2 )
+		return false;
 
-	bool		VDXAPIENTRY IsKey(sint64 lSample);
+	bool bHasDelta = false;
+	m_pts.reserve( pStream->nb_index_entries );
+	for ( int i = 0; i < pStream->nb_index_entries; ++i )
+	{
+		if ( !(pStream->index_entries[i].flags & AVINDEX_KEYFRAME) )
+			bHasDelta = true;
+		m_pts.push_back( pStream->index_entries[i].timestamp );
+	}
 
-	sint64		VDXAPIENTRY GetFrameNumberForSample(sint64 sample_num);
-	sint64		VDXAPIENTRY GetSampleNumberForFrame(sint64 display_num);
-	sint64		VDXAPIENTRY GetRealFrame(sint64 display_num);
+	//Keyframes only index is useless for frames mapping;
+	if ( !bHasDelta )
+	{
+		clear();
+		return false;
+	}
 
-	sint64		VDXAPIENTRY GetSampleBytePosition(sint64 sample_num);
+	finalize();
+	if ( empty() )
+		return false;
 
-public:
-	//Decoder Interface
-	const void *VDXAPIENTRY DecodeFrame(const void *inputBuffer, uint32 data_len, bool is_preroll, sint64 streamFrame, sint64 targetFrame);
-	uint32		VDXAPIENTRY GetDecodePadding();
-	void		VDXAPIENTRY Reset();
-	bool		VDXAPIENTRY IsFrameBufferValid();
-	const VDXPixmap& VDXAPIENTRY GetFrameBuffer();
-	bool		VDXAPIENTRY SetTargetFormat(int format, bool useDIBAlignment);
-	bool		VDXAPIENTRY SetDecompressedFormat(const VDXBITMAPINFOHEADER *pbih);
+	//Index built while probing holds start of stream only;
+	bool bPartial = ( pStream->nb_frames > 0 ) ? pStream->nb_index_entries < pStream->nb_frames :
+		duration > 0 && ( m_pts.back() - m_pts.front() ) * 10 < duration * 9;
+	if ( bPartial )
+	{
+		clear();
+		return false;
+	}
 
-	const void *VDXAPIENTRY GetFrameBufferBase();
-	bool		VDXAPIENTRY IsDecodable(sint64 sample_num);
+	//Index of MP4/MOV holds dts, sorted they trail pts by reorder delay: first frame is stream start;
+	int64 first = m_pts.front();
+	for ( size_t i = 0; i < m_pts.size(); ++i )
+		m_pts[i] -= first;
 
-public:
-	//Model Interface
-	//void	VDXAPIENTRY Reset();
-	void	VDXAPIENTRY SetDesiredFrame(sint64 frame_num);
-	sint64	VDXAPIENTRY GetNextRequiredSample(bool& is_preroll);
-	int		VDXAPIENTRY GetRequiredCount();
+	return true;
+}
 
-public:
-	//Internal
-	int			initStream( IFFSource* pSource, int indexStream, VDFFOptions* pOpts );
-	void		invalidateBuffer( void );
-	void		notifySeek( int64 timestamp );
+void VDFFTimecodes::finalize( void )
+{
+	//Packets come in decode order;
+	std::sort( m_pts.begin(), m_pts.end() );
+	m_pts.erase( std::unique( m_pts.begin(), m_pts.end() ), m_pts.end() );
 
-	sint64		getPts(  AVPacket* pPacket );
+	if ( m_pts.size() < 2 )
+		clear();
+}
 
-	uint32		prepareFrameBuffer( AVPicture* p, int format, void* pFrameBuffer );
-	bool		decodeFramePacket( AVFrame* pFrame, AVPacket* pPacket );
-	int64		guessPts( AVPacket* pPacket );
+double VDFFTimecodes::getFrameDuration( void ) const
+{
+	if ( m_pts.size() < 2 )
+		return 0;
 
-	//Convert frame number to timestamp;
-	int64		pos2ts( sint64 num ) const;
+	return ( m_pts.back() - m_pts.front() ) / (double)( m_pts.size() - 1 );
+}
 
-	sint64		ts2pos( int64 ts ) const;
+int64 VDFFTimecodes::pos2ts( sint64 pos ) const
+{
+	sint64 last = size() - 1;
 
+	if ( pos < 0 )
+		return m_pts.front() + (int64)( pos * getFrameDuration() - 0.5 );
 
-private:
-	const VDXInputDriverContext&	mContext;
-	AVFormatContext					*m_pFormatCtx;
-	AVStream						*m_pStreamCtx;
-	AVCodecContext					*m_pCodecCtx;
+	if ( pos > last )
+		return m_pts.back() + (int64)( ( pos - last ) * getFrameDuration() + 0.5 );
 
-	SwsContext						*m_pSwsCtx;
-	VDXStreamSourceInfo				m_streamInfo;
+	return m_pts[(size_t)pos];
+}
 
-	VDXPixmap						m_pixmap;
-	//Buffer for pixmap;
-	std::vector<uint8>				m_frameBuffer;
-	//Buffers of two sequenced frames;  
-	std::vector<uint8>				m_currentBuffer;
-	std::vector<uint8>				m_nextBuffer;
-	AVFrame							m_avframe;
-	int								m_fmtBuffer;
+sint64 VDFFTimecodes::ts2pos( int64 ts ) const
+{
+	if ( ts < m_pts.front() )
+		return 0;
 
-	sint64							m_posDecode;
-	bool							m_bResetDecoder;
-	
-private:
-	sint64							m_posDesired;
-	sint64							m_posCurrent;
-	sint64							m_posNext;
-	//Threshold for seek;
-	sint64							m_posDelta;
-	sint64							m_posDesync;
-	bool							m_bStreamSeeked;
+	if ( ts > m_pts.back() )
+		return size() - 1 + (sint64)( ( ts - m_pts.back() ) / getFrameDuration() + 0.5 );
 
-private:
-	byte							m_bAdjustPAR;
-	int64							m_tsStart;
+	//Last frame shown at ts;
+	return (sint64)( std::upper_bound( m_pts.begin(), m_pts.end(), ts ) - m_pts.begin() ) - 1;
+}
 
-	
-};
+///////////////////////////////////////////////////////////////////////////////
+//Performance counter ticks;
+static inline double VDFFTicks( void )
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter( &counter );
+	return (double)counter.QuadPart;
+}
 
-VDFFVideoSource::VDFFVideoSource(const VDXInputDriverContext& context):
-VDFFStreamBase( AVMEDIA_TYPE_VIDEO ),
-	m_posDecode( -1 ),
-	m_posDesired(-1),
-	m_pFormatCtx( NULL ),
-	m_pStreamCtx( NULL ),
-	m_pCodecCtx( NULL ),
-	m_pSwsCtx( NULL ),
-	m_posNext(-1),
-	m_tsStart( 0 ),
-	m_bStreamSeeked(false),
-	m_fmtBuffer( 0 ),
-	mContext(context)
+//Running average of measured time;
+static inline void updateCost( double& cost, double time )
 {
+	cost = ( cost > 0 ) ? cost + ( time - cost ) / DECODE_COST_WEIGHT : time;
+}
 
+//Frame buffer planes start at aligned address, buffer has OUTPUT_ALIGN bytes spare;
+static inline uint8* VDFFAlignedBase( std::vector<uint8>& buffer )
+{
+	return (uint8*)( ( (uintptr_t)&buffer[0] + OUTPUT_ALIGN - 1 ) & ~(uintptr_t)( OUTPUT_ALIGN - 1 ) );
 }
 
-VDFFVideoSource::~VDFFVideoSource() 
+//64-bit FNV-1a, words at once;
+static uint64 VDFFHash( const uint8* pData, size_t size, uint64 hash = 14695981039346656037ULL )
 {
-	if ( m_pCodecCtx )
-		// Close the codec
-		avcodec_close(m_pCodecCtx);
+	const uint64 prime = 1099511628211ULL;
+
+	for ( ; size >= sizeof( uint64 ); size -= sizeof( uint64 ), pData += sizeof( uint64 ) )
+		hash = ( hash ^ *(const uint64*)pData ) * prime;
+
+	for ( ; size > 0; --size, ++pData )
+		hash = ( hash ^ *pData ) * prime;
 
-	if ( m_pSwsCtx )
-		sws_freeContext( m_pSwsCtx );
+	return hash;
 }
 
+class VDFFVideoSource;
 
-int VDFFVideoSource::AddRef() {
-	return vdxunknown<IVDXStreamSource>::AddRef();
+//Frames repeating preceding one: candidates found by packets, confirmed by decoded pictures;
+class VDFFDuplicates
+{
+public:
+	VDFFDuplicates();
+	~VDFFDuplicates();
+
+	void	clear( void ) { m_state.clear(); m_hashes.clear(); }
+
+	//Scan file on own thread, nothing is duplicate until it finishes;
+	//frames mapping is copied from source: timecodes, or start and rate (frames per timebase unit);
+	bool	startScan( const char* filename, int indexStream, const VDFFTimecodes& timecodes, int64 tsStart, double rate, sint64 count, bool bIntraOnly );
+	void	stopScan( void );
+
+	bool	isActive( void ) const { return m_bReady && !m_state.empty(); }
+	bool	isDuplicate( sint64 sample ) const { return getState( sample ) == kDuplicate; }
+	//First frame of run of duplicates;
+	sint64	getOrigin( sint64 sample ) const;
+
+	//Hash decoded picture if it decides about candidate;
+	void	confirm( sint64 sample, const std::vector<uint8>& picture );
+	//Same with picture hashed by VDFFHash elsewhere, 0 - unknown;
+	void	confirmHash( sint64 sample, uint64 hash );
+
+protected:
+	enum
+	{
+		kUnknown = 0,
+		kCandidate,
+		kDuplicate,
+		kDistinct
+	};
+
+	uint8	getState( sint64 sample ) const
+	{
+		return ( m_bReady && sample >= 0 && sample < (sint64)m_state.size() ) ? m_state[(size_t)sample] : (uint8)kUnknown;
+	}
+	void	decide( sint64 sample );
+
+	//Read sizes and hashes of all stream packets through own demuxer, no codecs are opened;
+	bool	scanFile( void );
+	sint64	ts2pos( int64 ts ) const;
+	static unsigned __stdcall scanThread( void* pParam );
+
+	std::vector<uint8>		m_state;
+	//Decoded pictures hashes, 0 - unknown;
+	std::vector<uint64>		m_hashes;
+
+	HANDLE					m_hThread;
+	//State is filled by scan thread, reader sees it only after that;
+	volatile LONG			m_bReady;
+	volatile bool			m_bCancel;
+
+	std::string				m_filename;
+	int						m_indexStream;
+	VDFFTimecodes			m_timecodes;
+	int64					m_tsStart;
+	double					m_rate;
+	sint64					m_count;
+	bool					m_bIntraOnly;
+};
+
+VDFFDuplicates::VDFFDuplicates():
+	m_hThread( NULL ),
+	m_bReady( 0 ),
+	m_bCancel( false ),
+	m_indexStream( -1 ),
+	m_tsStart( 0 ),
+	m_rate( 0 ),
+	m_count( 0 ),
+	m_bIntraOnly( false )
+{
 }
 
-int VDFFVideoSource::Release() {
-	return vdxunknown<IVDXStreamSource>::Release();
+VDFFDuplicates::~VDFFDuplicates()
+{
+	stopScan();
 }
 
-void *VDXAPIENTRY VDFFVideoSource::AsInterface(uint32 iid)
+bool VDFFDuplicates::startScan( const char* filename, int indexStream, const VDFFTimecodes& timecodes, int64 tsStart, double rate, sint64 count, bool bIntraOnly )
 {
-	if (iid == IVDXVideoSource::kIID)
-		return static_cast<IVDXVideoSource *>(this);
+	stopScan();
+	clear();
 
-	return vdxunknown<IVDXStreamSource>::AsInterface(iid);
+	if ( count < 2 )
+		return false;
+
+	m_filename = filename;
+	m_indexStream = indexStream;
+	m_timecodes = timecodes;
+	m_tsStart = tsStart;
+	m_rate = rate;
+	m_count = count;
+	m_bIntraOnly = bIntraOnly;
+	m_bReady = 0;
+	m_bCancel = false;
+
+	m_hThread = (HANDLE)_beginthreadex( NULL, 0, scanThread, this, 0, NULL );
+	return m_hThread != NULL;
 }
 
+void VDFFDuplicates::stopScan( void )
+{
+	if ( !m_hThread )
+		return;
 
+	m_bCancel = true;
+	WaitForSingleObject( m_hThread, INFINITE );
+	CloseHandle( m_hThread );
+	m_hThread = NULL;
+}
 
-int VDFFVideoSource::initStream( IFFSource* pSource, int streamIndex, VDFFOptions* pOpts )
+unsigned __stdcall VDFFDuplicates::scanThread( void* pParam )
 {
-	int result = VDFFStreamBase::initStream( pSource, streamIndex );
-	if ( result < 0 )
-		return result;
+	VDFFDuplicates* pThis = (VDFFDuplicates*)pParam;
 
-	m_pFormatCtx = pSource->getContext();
-	m_pStreamCtx = m_pFormatCtx->streams[getIndex()];
-	m_pCodecCtx = m_pStreamCtx->codec;
+	if ( pThis->scanFile() )
+		InterlockedExchange( &pThis->m_bReady, 1 );
 
-	//TODO:
-	//framerate = 1.0/(m_pCodecCtx->ticks_per_frame * m_pCodecCtx->time_base)
-	// Find the decoder for the video stream
-	AVCodec* pDecoder = avcodec_find_decoder(m_pCodecCtx->codec_id);
-	if( pDecoder==NULL ) return -1; // Codec not found
+	return 0;
+}
 
-	// Open codec
-	if(avcodec_open(m_pCodecCtx, pDecoder)<0)	return -1;
+sint64 VDFFDuplicates::ts2pos( int64 ts ) const
+{
+	if ( !m_timecodes.empty() )
+		return m_timecodes.ts2pos( ts - m_tsStart );
 
-	m_tsStart = 0;
+	return (sint64)( ( ts - m_tsStart ) * m_rate + 0.5 );
+}
 
-	if ( m_pStreamCtx->duration == AV_NOPTS_VALUE )
-		m_streamInfo.mSampleCount = this->ts2pos( m_pFormatCtx->duration * m_pStreamCtx->time_base.den / ( m_pStreamCtx->time_base.num * AV_TIME_BASE ) );
-	else
-		m_streamInfo.mSampleCount = this->ts2pos( m_pStreamCtx->duration );
+sint64 VDFFDuplicates::getOrigin( sint64 sample ) const
+{
+	while ( isDuplicate( sample ) )
+		--sample;
 
-	if ( m_pStreamCtx->start_time == AV_NOPTS_VALUE )
-		m_tsStart = m_pFormatCtx->start_time * m_pStreamCtx->time_base.den / ( m_pStreamCtx->time_base.num * AV_TIME_BASE );
-	else
-		m_tsStart = m_pStreamCtx->start_time;
+	return sample;
+}
 
-	m_streamInfo.mSampleRate.mNumerator = m_pStreamCtx->r_frame_rate.num;
-	m_streamInfo.mSampleRate.mDenominator = m_pStreamCtx->r_frame_rate.den;
+void VDFFDuplicates::confirm( sint64 sample, const std::vector<uint8>& picture )
+{
+	if ( picture.size() <= 1 || 
+		( getState( sample ) != kCandidate && getState( sample + 1 ) != kCandidate ) )
+		return;
 
-	m_streamInfo.mPixelAspectRatio.mNumerator =  1;
-	m_streamInfo.mPixelAspectRatio.mDenominator = 1;
+	if ( m_hashes[(size_t)sample] == 0 )
+		m_hashes[(size_t)sample] = VDFFHash( &picture[0], picture.size() ) | 1;
 
-	m_bAdjustPAR = pOpts->bAdjustPAR;
+	decide( sample );
+	decide( sample + 1 );
+}
 
-	int numAR = 1;
-	int denAR = 1;
-	
-	if ( m_pStreamCtx->sample_aspect_ratio.num )
-	{
-		numAR =  m_pStreamCtx->sample_aspect_ratio.num;
-		denAR = m_pStreamCtx->sample_aspect_ratio.den;
-	}
-	else if ( m_pCodecCtx->sample_aspect_ratio.num )
-	{
-		numAR =  m_pCodecCtx->sample_aspect_ratio.num;
-		denAR = m_pCodecCtx->sample_aspect_ratio.den;
-	}
+void VDFFDuplicates::confirmHash( sint64 sample, uint64 hash )
+{
+	if ( hash == 0 ||
+		( getState( sample ) != kCandidate && getState( sample + 1 ) != kCandidate ) )
+		return;
 
-	if ( !m_bAdjustPAR )
-	{
-		m_streamInfo.mPixelAspectRatio.mNumerator =  numAR;
-		m_streamInfo.mPixelAspectRatio.mDenominator = denAR;
+	m_hashes[(size_t)sample] = hash;
 
-	}
+	decide( sample );
+	decide( sample + 1 );
+}
 
-	m_pixmap.w =  m_pCodecCtx->width;
-	m_pixmap.h =  m_pCodecCtx->height;
+void VDFFDuplicates::decide( sint64 sample )
+{
+	if ( getState( sample ) != kCandidate )
+		return;
 
-	if ( m_bAdjustPAR )
-	{
-		double dar = numAR/
-			(double)denAR;
+	uint64 hash = m_hashes[(size_t)sample];
+	uint64 hashPrev = m_hashes[(size_t)sample - 1];
 
-		//double par = m_pCodecCtx->width/
-		//	(double)m_pCodecCtx->height;
+	if ( hash && hashPrev )
+		m_state[(size_t)sample] = ( hash == hashPrev ) ? kDuplicate : kDistinct;
+}
 
-		if ( dar > 1 )
-			m_pixmap.w = (int)(m_pCodecCtx->width * dar + 0.5);
-		else if ( dar < 1 )
-			m_pixmap.h =  (int)(m_pCodecCtx->height / dar + 0.5);
+///////////////////////////////////////////////////////////////////////////////
+//Presentation timestamps of packets held by decoder (B-frames reorder),
+//frames leave decoder in presentation order;
+class VDFFReorderWindow
+{
+public:
+	void	clear( void ) { m_pts.clear(); m_dts.clear(); }
 
-	
-	}
-	
-	m_frameBuffer.reserve( m_pixmap.w * m_pixmap.h * 4);
-	m_currentBuffer.reserve(   m_pixmap.w * m_pixmap.h * 4 );
-	m_nextBuffer.reserve(   m_pixmap.w * m_pixmap.h * 4 );
+	//Packet fed to decoder, delay - frames held by decoder (has_b_frames);
+	void	push( const AVPacket* pPacket, int delay );
+	//Timestamp of frame out of decoder, guessed from packets if frame has none;
+	int64	pop( const AVFrame* pFrame );
 
-	m_currentBuffer.resize(1);
-	m_nextBuffer.resize(1);
+protected:
+	static void	trim( std::multiset<int64>& window, size_t size );
 
-	avcodec_get_frame_defaults( &m_avframe );
+	//Both sorted, lowest presentation time leaves decoder first;
+	std::multiset<int64>	m_pts;
+	//Packets without pts, decode order tells presentation order only without reordering;
+	std::multiset<int64>	m_dts;
+};
 
-	m_posDelta = MAX_PACKETS_DELTA;
-	m_posDesync = ts2pos( (sint64)(MAX_DESYNC_TIME / av_q2d( m_pStreamCtx->time_base )) );
+void VDFFReorderWindow::trim( std::multiset<int64>& window, size_t size )
+{
+	while ( window.size() > size )
+		window.erase( window.begin() );
+}
 
-	//Register source;
-	if ( !this->getSource()->setStream( this ) )
-		return -1;
-	m_posCurrent = 0;
-	m_posNext = m_posCurrent;
+void VDFFReorderWindow::push( const AVPacket* pPacket, int delay )
+{
+	if ( pPacket->pts != AV_NOPTS_VALUE )
+		m_pts.insert( pPacket->pts );
+	else if ( pPacket->dts != AV_NOPTS_VALUE )
+		m_dts.insert( pPacket->dts );
+	else
+		return;
 
-	m_bStreamSeeked = true;
-	//Load first frame;
-	uint32 cnt, bytes;
-	this->Read( 0, 1, NULL, 0, &bytes, &cnt );
+	//Window can't be longer than decoder delay, drop leftovers of broken streams;
+	size_t size = FFMAX( delay, 0 ) + REORDER_DELAY_MARGIN;
+	trim( m_pts, size );
+	trim( m_dts, size );
+}
 
-	return result;
+int64 VDFFReorderWindow::pop( const AVFrame* pFrame )
+{
+	int64 pts = pFrame->best_effort_timestamp;
+
+	if ( pts == AV_NOPTS_VALUE )
+	{
+		//Presentation times first, decode times are guess only;
+		if ( !m_pts.empty() )
+			pts = *m_pts.begin();
+		else if ( !m_dts.empty() )
+			pts = *m_dts.begin();
+		else
+			return AV_NOPTS_VALUE;
+	}
+
+	//Earlier packets were shown or skipped by decoder;
+	m_pts.erase( m_pts.begin(), m_pts.upper_bound( pts ) );
+	m_dts.erase( m_dts.begin(), m_dts.upper_bound( pts ) );
+	return pts;
 }
 
-void VDFFVideoSource::invalidateBuffer( void )
+///////////////////////////////////////////////////////////////////////////////
+//Own demuxer and decoder of video stream, decodes raw frames independently of source;
+class VDFFDecoderCursor
+{
+public:
+	VDFFDecoderCursor();
+	~VDFFDecoderCursor();
+
+	bool	open( const char* filename, int indexStream, int lowres );
+	void	close( void );
+
+	//Seek to keyframe at or before timestamp;
+	bool	seek( int64 timestamp );
+	//Same decoder quality and skipped frames as source decoder;
+	void	setQuality( bool bDraft, bool bKeyframesOnly );
+	//Decode next frame in display order, raw layout of decoder format;
+	//frames nobody refers to are skipped before preroll timestamp;
+	bool	decodeNext( std::vector<uint8>& buffer, int64& timestamp, int64 tsPreroll = AV_NOPTS_VALUE );
+	//Timestamps of all keyframes in stream, reads whole file;
+	bool	scanKeyFrames( std::vector<int64>& timestamps );
+
+	AVCodecContext*		getCodec( void ) const { return m_pCodecCtx; }
+
+protected:
+	AVFormatContext		*m_pFormatCtx;
+	AVCodecContext		*m_pCodecCtx;
+	int					m_indexStream;
+	AVFrame				m_frame;
+	VDFFReorderWindow	m_reorder;
+	bool				m_bEof;
+	bool				m_bKeyframesOnly;
+};
+
+VDFFDecoderCursor::VDFFDecoderCursor():
+	m_pFormatCtx( NULL ),
+	m_pCodecCtx( NULL ),
+	m_indexStream( -1 ),
+	m_bEof( false ),
+	m_bKeyframesOnly( false )
 {
-	VDFFStreamBase::invalidateBuffer(  );
-	//Decode sequence breaked;
-	avcodec_flush_buffers( m_pCodecCtx );
-	m_posNext = -1;
-	m_posCurrent = m_streamInfo.mSampleCount;
-	m_bStreamSeeked = true;
 }
 
-void VDFFVideoSource::notifySeek( int64 timestamp )
+VDFFDecoderCursor::~VDFFDecoderCursor()
 {
-	m_posNext = ts2pos( timestamp ) + 1;
-	AVPacket *pPacket = queryPacket();
-	sint64 pts = getPts( pPacket );
-	if ( pPacket && pts != AV_NOPTS_VALUE )
+	close();
+}
+
+bool VDFFDecoderCursor::open( const char* filename, int indexStream, int lowres )
+{
+	close();
+
+	if ( avformat_open_input( &m_pFormatCtx, filename, NULL, NULL ) != 0 )
+		return false;
+
+	m_pFormatCtx->flags |= AVFMT_FLAG_GENPTS;
+
+	if ( avformat_find_stream_info( m_pFormatCtx, NULL ) < 0 || 
+		indexStream >= (int)m_pFormatCtx->nb_streams )
 	{
-		m_posCurrent = ts2pos( pts );
+		close();
+		return false;
 	}
-	else
+
+	AVCodecContext* pCodecCtx = m_pFormatCtx->streams[indexStream]->codec;
+	AVCodec* pDecoder = avcodec_find_decoder( pCodecCtx->codec_id );
+	if ( pDecoder == NULL )
 	{
-		m_posCurrent = ts2pos( timestamp ) - 1;
+		close();
+		return false;
 	}
-	
+
+	//Same frame size as source decoder;
+	pCodecCtx->lowres = FFMIN( lowres, pDecoder->max_lowres );
+
+	if ( avcodec_open( pCodecCtx, pDecoder ) < 0 )
+	{
+		close();
+		return false;
+	}
+
+	m_pCodecCtx = pCodecCtx;
+	m_indexStream = indexStream;
+	m_bEof = false;
+	m_reorder.clear();
+	avcodec_get_frame_defaults( &m_frame );
+
+	return true;
 }
 
+void VDFFDecoderCursor::close( void )
+{
+	if ( m_pCodecCtx )
+		avcodec_close( m_pCodecCtx );
+	m_pCodecCtx = NULL;
 
-bool	VDFFVideoSource::decodeFramePacket(  AVFrame* pFrame, AVPacket* pPacket )
+	if ( m_pFormatCtx )
+		av_close_input_file( m_pFormatCtx );
+	m_pFormatCtx = NULL;
+}
+
+bool VDFFDecoderCursor::seek( int64 timestamp )
+{
+	if ( !m_pCodecCtx )
+		return false;
+
+	if ( av_seek_frame( m_pFormatCtx, m_indexStream, timestamp, AVSEEK_FLAG_BACKWARD ) < 0 )
+		return false;
+
+	avcodec_flush_buffers( m_pCodecCtx );
+	m_reorder.clear();
+	m_bEof = false;
+	return true;
+}
+
+void VDFFDecoderCursor::setQuality( bool bDraft, bool bKeyframesOnly )
 {
+	if ( !m_pCodecCtx )
+		return;
+
+	m_pCodecCtx->skip_loop_filter = bDraft ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+	m_pCodecCtx->skip_idct = bDraft ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	if ( bDraft )
+		m_pCodecCtx->flags2 |= CODEC_FLAG2_FAST;
+	else
+		m_pCodecCtx->flags2 &= ~CODEC_FLAG2_FAST;
+
+	m_pCodecCtx->skip_frame = bKeyframesOnly ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+	m_bKeyframesOnly = bKeyframesOnly;
+}
+
+bool VDFFDecoderCursor::decodeNext( std::vector<uint8>& buffer, int64& timestamp, int64 tsPreroll )
+{
+	if ( !m_pCodecCtx )
+		return false;
+
 	int gotFrame = 0;
-	AVPacket packet = *pPacket;
 
-	for(;;)
+	while ( !gotFrame )
 	{
-		int len = avcodec_decode_video2( m_pCodecCtx, pFrame, &gotFrame, &packet );
-		if ( len >= 0 && len < packet.size )
+		AVPacket packet;
+		av_init_packet( &packet );
+		avcodec_get_frame_defaults( &m_frame );
+
+		if ( m_bEof )
 		{
-			packet.data += len;
-			packet.size -= len;
+			//Drain frames delayed by decoder;
+			packet.data = NULL;
+			packet.size = 0;
+			avcodec_decode_video2( m_pCodecCtx, &m_frame, &gotFrame, &packet );
+			if ( !gotFrame )
+				return false;
+			break;
 		}
-		else break;
+
+		int ret = av_read_frame( m_pFormatCtx, &packet );
+		if ( ret < 0 )
+		{
+			if ( ret == AVERROR_EOF || m_pFormatCtx->pb->eof_reached )
+				m_bEof = true;
+			continue;
+		}
+
+		if ( packet.stream_index == m_indexStream )
+		{
+			if ( !m_bKeyframesOnly )
+			{
+				int64 pts = ( packet.pts != AV_NOPTS_VALUE ) ? packet.pts : packet.dts;
+				bool bPreroll = tsPreroll != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE && pts < tsPreroll;
+				m_pCodecCtx->skip_frame = bPreroll ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+			}
+
+			m_reorder.push( &packet, m_pCodecCtx->has_b_frames );
+
+			AVPacket chunk = packet;
+			for(;;)
+			{
+				int len = avcodec_decode_video2( m_pCodecCtx, &m_frame, &gotFrame, &chunk );
+				if ( len >= 0 && len < chunk.size )
+				{
+					chunk.data += len;
+					chunk.size -= len;
+				}
+				else break;
+			}
+		}
+
+		av_free_packet( &packet );
 	}
-	return (gotFrame > 0);
+
+	uint32 size = avpicture_get_size( m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height );
+	buffer.resize( size );
+	avpicture_layout( (AVPicture*)&m_frame, m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height,
+		&buffer[0], (int)buffer.size() );
+
+	timestamp = m_reorder.pop( &m_frame );
+	return true;
 }
 
-//Experimental
-uint32 VDFFVideoSource::prepareFrameBuffer( AVPicture* p, int format, void* pFrameBuffer )
+bool VDFFDecoderCursor::scanKeyFrames( std::vector<int64>& timestamps )
 {
-	if ( p ==NULL || p->data[0] == NULL )
-		return 0;
+	timestamps.clear();
 
-	uint8_t *pBuffer = (uint8_t *)pFrameBuffer;//mpFrameBuffer;
+	if ( !m_pCodecCtx || av_seek_frame( m_pFormatCtx, m_indexStream, 0, AVSEEK_FLAG_BACKWARD ) < 0 )
+		return false;
 
-	int wSrc = m_pCodecCtx->width;
-	int hSrc = m_pCodecCtx->height;
+	AVPacket packet;
+	av_init_packet( &packet );
 
-	int wDst = m_pixmap.w;
-	int hDst = m_pixmap.h;
+	while ( av_read_frame( m_pFormatCtx, &packet ) >= 0 )
+	{
+		if ( packet.stream_index == m_indexStream && ( packet.flags & AV_PKT_FLAG_KEY ) )
+		{
+			if ( packet.pts != AV_NOPTS_VALUE )
+				timestamps.push_back( packet.pts );
+			else if ( packet.dts != AV_NOPTS_VALUE )
+				timestamps.push_back( packet.dts );
+		}
+		av_free_packet( &packet );
+	}
 
-	AVPicture* pPicture = p;
+	std::sort( timestamps.begin(), timestamps.end() );
+	m_bEof = true;
 
-	uint8_t* dstData[4] = {NULL, NULL, NULL, NULL};
-	int		dstStride[4] = {0, 0, 0, 0};
+	return !timestamps.empty();
+}
 
-	uint32 size = 0;
+///////////////////////////////////////////////////////////////////////////////
+//Conversion of decoded frame;
+struct VDFFScaleParams
+{
+	int				wSrc;
+	int				hSrc;
+	PixelFormat		srcFmt;
+	int				wDst;
+	int				hDst;
+	PixelFormat		dstFmt;
+	int				flags;
+	//AVColorSpace of source and full range flag;
+	int				colorspace;
+	int				srcRange;
+
+	bool operator==( const VDFFScaleParams& p ) const
+	{
+		return wSrc == p.wSrc && hSrc == p.hSrc && srcFmt == p.srcFmt &&
+			wDst == p.wDst && hDst == p.hDst && dstFmt == p.dstFmt &&
+			flags == p.flags && colorspace == p.colorspace && srcRange == p.srcRange;
+	}
+};
 
-	switch(format) {
-	case nsVDXPixmap::kPixFormat_YUV420_Planar:
-		{
-			dstData[0] = pBuffer;					dstStride[0] = wDst;
-			dstData[1] = dstData[0] + wDst*hDst;			dstStride[1] = wDst >> 1;
-			dstData[2] = dstData[1] +  (wDst*hDst >> 2);	dstStride[2] = wDst >> 1;
+//Scaler contexts of recently used conversions, switch of target format doesn't rebuild filters;
+class VDFFScalerTable
+{
+public:
+	VDFFScalerTable(): m_counter( 0 ) {}
+	~VDFFScalerTable() { clear(); }
 
-			size = wDst*hDst + (wDst*hDst >> 1);
-			if ( pBuffer == NULL ) break;
+	SwsContext*	get( const VDFFScaleParams& params );
+	void		clear( void );
 
-			m_pSwsCtx = sws_getCachedContext(m_pSwsCtx, wSrc, hSrc,
-				m_pCodecCtx->pix_fmt,
-				wDst, hDst, PIX_FMT_YUV420P, SWS_BICUBIC,
-				NULL, NULL, NULL);
+protected:
+	struct Entry
+	{
+		VDFFScaleParams		params;
+		SwsContext*			pSwsCtx;
+		uint32				lastUsed;
+	};
 
-			sws_scale( m_pSwsCtx, pPicture->data, pPicture->linesize, 0,
-				m_pCodecCtx->height, dstData, dstStride);
+	std::vector<Entry>		m_entries;
+	uint32					m_counter;
+};
 
-		}
-		break;
+SwsContext* VDFFScalerTable::get( const VDFFScaleParams& params )
+{
+	size_t index = m_entries.size();
 
-	case nsVDXPixmap::kPixFormat_Y8:
+	for ( size_t i = 0; i < m_entries.size(); ++i )
+	{
+		if ( m_entries[i].params == params )
 		{
-			dstData[0] = pBuffer;					dstStride[0] = wDst;
-			dstData[1] = dstData[0] + wDst*hDst;			dstStride[1] = wDst >> 1;
-			dstData[2] = dstData[1];				dstStride[2] = wDst >> 1;
+			m_entries[i].lastUsed = ++m_counter;
+			return m_entries[i].pSwsCtx;
+		}
 
-			size = wDst*hDst ;
-			if ( pBuffer == NULL ) break;
+		if ( index == m_entries.size() || m_entries[i].lastUsed < m_entries[index].lastUsed )
+			index = i;
+	}
 
-			m_pSwsCtx = sws_getCachedContext(m_pSwsCtx, wSrc, hSrc,
-				m_pCodecCtx->pix_fmt,
-				wDst, hDst, PIX_FMT_YUV420P, SWS_BICUBIC,
-				NULL, NULL, NULL);
+	SwsContext* pSwsCtx = sws_getContext( params.wSrc, params.hSrc, params.srcFmt,
+		params.wDst, params.hDst, params.dstFmt, params.flags, NULL, NULL, NULL );
 
-			sws_scale( m_pSwsCtx, pPicture->data, pPicture->linesize, 0,
-				m_pCodecCtx->height, dstData, dstStride);
+	if ( !pSwsCtx )
+		return NULL;
 
-		
-		}
-		break;
+	//Matrix of source, range of JPEG formats is already known by scaler;
+	int *invTable, *table;
+	int srcRange, dstRange, brightness, contrast, saturation;
+	if ( sws_getColorspaceDetails( pSwsCtx, &invTable, &srcRange, &table, &dstRange, &brightness, &contrast, &saturation ) >= 0 )
+		sws_setColorspaceDetails( pSwsCtx, sws_getCoefficients( params.colorspace ), srcRange | params.srcRange,
+			table, dstRange, brightness, contrast, saturation );
 
-	case nsVDXPixmap::kPixFormat_YUV422_UYVY:
-		dstData[0] = pBuffer;					dstStride[0] = wDst*2;
+	//Replace least recently used;
+	if ( m_entries.size() < MAX_SCALER_CONTEXTS )
+	{
+		m_entries.push_back( Entry() );
+		index = m_entries.size() - 1;
+	}
+	else
+		sws_freeContext( m_entries[index].pSwsCtx );
 
-		size = wDst*2*hDst;
-		if ( pBuffer == NULL ) break;
+	m_entries[index].params = params;
+	m_entries[index].pSwsCtx = pSwsCtx;
+	m_entries[index].lastUsed = ++m_counter;
+
+	return pSwsCtx;
+}
 
-		m_pSwsCtx = sws_getCachedContext(m_pSwsCtx, wSrc, hSrc,
-			m_pCodecCtx->pix_fmt,
-			wDst, hDst, PIX_FMT_UYVY422, SWS_FAST_BILINEAR,
-			NULL, NULL, NULL);
+void VDFFScalerTable::clear( void )
+{
+	for ( size_t i = 0; i < m_entries.size(); ++i )
+		sws_freeContext( m_entries[i].pSwsCtx );
+	m_entries.clear();
+}
 
-		sws_scale( m_pSwsCtx, pPicture->data, pPicture->linesize, 0,
-			m_pCodecCtx->height, dstData, dstStride);
+///////////////////////////////////////////////////////////////////////////////
+//Converted frames of recent random requests (repaints, pane switches, filter preview);
+class VDFFOutputCache
+{
+public:
+	VDFFOutputCache(): m_memory( 0 ), m_pinned( 0 ) {}
+
+	//Frames are told apart by target format, decoder quality and scaler flags;
+	bool	contains( sint64 sample, int format, bool bDraft, int flags ) const;
+	//Keep frame until restored, Read promised it to DecodeFrame;
+	bool	pin( sint64 sample, int format, bool bDraft, int flags );
+	void	unpin( sint64 sample, int format, bool bDraft, int flags );
+	//Copy cached frame into frame buffer (and unpin it);
+	bool	restore( sint64 sample, int format, bool bDraft, int flags, uint8* pBuffer );
+	void	store( sint64 sample, int format, bool bDraft, int flags, const uint8* pBuffer, size_t size );
+	void	clear( void ) { m_entries.clear(); m_memory = 0; m_pinned = 0; }
 
-		break;
-	case nsVDXPixmap::kPixFormat_YUV422_YUYV:
-		dstData[0] = pBuffer;					dstStride[0] = wDst*2;
+protected:
+	struct Entry
+	{
+		sint64				sample;
+		int					format;
+		//Converted from reduced (draft) decode;
+		bool				bDraft;
+		//Scaler used by conversion;
+		int					flags;
+		//Reads waiting for DecodeFrame;
+		int					pins;
+		std::vector<uint8>	data;
+	};
+
+	typedef std::list<Entry>	TEntryList;
+
+	TEntryList::iterator	find( sint64 sample, int format, bool bDraft, int flags );
+
+protected:
+	//Most recently used first;
+	TEntryList				m_entries;
+	size_t					m_memory;
+	int						m_pinned;
+};
+
+VDFFOutputCache::TEntryList::iterator VDFFOutputCache::find( sint64 sample, int format, bool bDraft, int flags )
+{
+	TEntryList::iterator it = m_entries.begin();
+	for ( ; it != m_entries.end(); ++it )
+	{
+		if ( it->sample == sample && it->format == format && it->bDraft == bDraft && it->flags == flags )
+			break;
+	}
+	return it;
+}
+
+bool VDFFOutputCache::contains( sint64 sample, int format, bool bDraft, int flags ) const
+{
+	return const_cast<VDFFOutputCache*>( this )->find( sample, format, bDraft, flags ) != m_entries.end();
+}
 
-		size = wDst*2*hDst;
-		if ( pBuffer == NULL ) break;
+bool VDFFOutputCache::pin( sint64 sample, int format, bool bDraft, int flags )
+{
+	TEntryList::iterator it = find( sample, format, bDraft, flags );
+	if ( it == m_entries.end() )
+		return false;
+
+	//Reads dropped by host never come to DecodeFrame, forget them all;
+	if ( m_pinned >= OUTPUT_CACHE_PINNED )
+	{
+		for ( TEntryList::iterator itPinned = m_entries.begin(); itPinned != m_entries.end(); ++itPinned )
+			itPinned->pins = 0;
+		m_pinned = 0;
+	}
+
+	m_entries.splice( m_entries.begin(), m_entries, it );
+	++it->pins;
+	++m_pinned;
+	return true;
+}
+
+void VDFFOutputCache::unpin( sint64 sample, int format, bool bDraft, int flags )
+{
+	TEntryList::iterator it = find( sample, format, bDraft, flags );
+	if ( it != m_entries.end() && it->pins > 0 )
+	{
+		--it->pins;
+		--m_pinned;
+	}
+}
+
+bool VDFFOutputCache::restore( sint64 sample, int format, bool bDraft, int flags, uint8* pBuffer )
+{
+	TEntryList::iterator it = find( sample, format, bDraft, flags );
+	if ( it == m_entries.end() )
+		return false;
+
+	m_entries.splice( m_entries.begin(), m_entries, it );
+
+	if ( it->pins > 0 )
+	{
+		--it->pins;
+		--m_pinned;
+	}
+
+	if ( !it->data.empty() )
+		memcpy( pBuffer, &it->data[0], it->data.size() );
+
+	return true;
+}
+
+void VDFFOutputCache::store( sint64 sample, int format, bool bDraft, int flags, const uint8* pBuffer, size_t size )
+{
+	int pins = 0;
+
+	TEntryList::iterator it = find( sample, format, bDraft, flags );
+	if ( it != m_entries.end() )
+	{
+		pins = it->pins;
+		m_memory -= it->data.size();
+		m_entries.erase( it );
+	}
+
+	m_entries.push_front( Entry() );
+	Entry& entry = m_entries.front();
+	entry.sample = sample;
+	entry.format = format;
+	entry.bDraft = bDraft;
+	entry.flags = flags;
+	entry.pins = pins;
+	entry.data.assign( pBuffer, pBuffer + size );
+	m_memory += size;
+
+	//Least recently used first, pinned frames stay;
+	it = m_entries.end();
+	while ( m_memory > OUTPUT_CACHE_MEMORY && --it != m_entries.begin() )
+	{
+		if ( it->pins > 0 )
+			continue;
+
+		m_memory -= it->data.size();
+		it = m_entries.erase( it );
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//Color conversion split into horizontal bands, every band by own thread and scaler;
+class VDFFBandConverter
+{
+public:
+	VDFFBandConverter();
+	~VDFFBandConverter();
+
+	//Convert frame of same height in source and destination, fails if frame isn't worth splitting;
+	bool	convert( const AVPicture* pSrc, const VDFFScaleParams& params, uint8_t* const dstData[4], const int dstStride[4] );
+
+protected:
+	struct Band
+	{
+		VDFFBandConverter*		pOwner;
+		HANDLE					hThread;
+		HANDLE					hWake;
+		HANDLE					hDone;
+		VDFFScalerTable			scalers;
+		//Band with overlap rows is converted here, inner rows copied to destination;
+		std::vector<uint8>		scratch;
+		int						y0;
+		int						y1;
+		bool					bFailed;
+	};
+
+	void	init( void );
+	void	convertBand( Band* pBand );
+	void	workerLoop( Band* pBand );
+	static unsigned __stdcall workerThread( void* pParam );
+
+protected:
+	//First band is converted by caller;
+	std::vector<Band*>			m_bands;
+	bool						m_bInit;
+	bool						m_bExit;
+
+	//Current frame;
+	const AVPicture*			m_pSrc;
+	VDFFScaleParams				m_params;
+	uint8_t*					m_dstData[4];
+	int							m_dstStride[4];
+};
+
+VDFFBandConverter::VDFFBandConverter():
+	m_bInit( false ),
+	m_bExit( false ),
+	m_pSrc( NULL )
+{
+}
+
+VDFFBandConverter::~VDFFBandConverter()
+{
+	m_bExit = true;
+
+	for ( size_t i = 0; i < m_bands.size(); ++i )
+	{
+		Band* pBand = m_bands[i];
+		if ( pBand->hThread )
+		{
+			SetEvent( pBand->hWake );
+			WaitForSingleObject( pBand->hThread, INFINITE );
+			CloseHandle( pBand->hThread );
+		}
+		if ( pBand->hWake )
+			CloseHandle( pBand->hWake );
+		if ( pBand->hDone )
+			CloseHandle( pBand->hDone );
+		delete pBand;
+	}
+}
+
+void VDFFBandConverter::init( void )
+{
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+
+	int bands = FFMIN( (int)info.dwNumberOfProcessors, MAX_CONVERT_THREADS );
+
+	for ( int i = 0; i < bands; ++i )
+	{
+		Band* pBand = new Band;
+		pBand->pOwner = this;
+		pBand->hThread = NULL;
+		pBand->hWake = NULL;
+		pBand->hDone = NULL;
+		pBand->bFailed = false;
+		m_bands.push_back( pBand );
+
+		if ( i == 0 )
+			continue;
+
+		pBand->hWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+		pBand->hDone = CreateEvent( NULL, FALSE, FALSE, NULL );
+		if ( pBand->hWake && pBand->hDone )
+			pBand->hThread = (HANDLE)_beginthreadex( NULL, 0, workerThread, pBand, 0, NULL );
+
+		if ( !pBand->hThread )
+		{
+			//Run with threads started so far;
+			if ( pBand->hWake )
+				CloseHandle( pBand->hWake );
+			if ( pBand->hDone )
+				CloseHandle( pBand->hDone );
+			delete pBand;
+			m_bands.pop_back();
+			break;
+		}
+	}
+}
+
+bool VDFFBandConverter::convert( const AVPicture* pSrc, const VDFFScaleParams& params, uint8_t* const dstData[4], const int dstStride[4] )
+{
+	if ( !m_bInit )
+	{
+		m_bInit = true;
+		init();
+	}
+
+	int h = params.hSrc;
+	int bands = FFMIN( (int)m_bands.size(), h / CONVERT_MIN_BAND );
+	if ( params.hDst != h || bands < 2 )
+		return false;
+
+	m_pSrc = pSrc;
+	m_params = params;
+	for ( int i = 0; i < 4; ++i )
+	{
+		m_dstData[i] = dstData[i];
+		m_dstStride[i] = dstStride[i];
+	}
+
+	//Edges on multiple of 4 rows keep chroma rows of every subsampling whole;
+	int rows = ( ( h + bands - 1 ) / bands + 3 ) & ~3;
+
+	int used = 0;
+	for ( int i = 0; i < bands && i * rows < h; ++i, ++used )
+	{
+		Band* pBand = m_bands[i];
+		pBand->y0 = i * rows;
+		pBand->y1 = FFMIN( ( i + 1 ) * rows, h );
+		pBand->bFailed = false;
+
+		if ( i > 0 )
+			SetEvent( pBand->hWake );
+	}
+
+	convertBand( m_bands[0] );
+
+	bool bFailed = m_bands[0]->bFailed;
+	for ( int i = 1; i < used; ++i )
+	{
+		WaitForSingleObject( m_bands[i]->hDone, INFINITE );
+		bFailed |= m_bands[i]->bFailed;
+	}
+
+	return !bFailed;
+}
+
+void VDFFBandConverter::convertBand( Band* pBand )
+{
+	//Overlap feeds vertical filter of chroma and scaler at band edges;
+	int a0 = FFMAX( pBand->y0 - CONVERT_BAND_OVERLAP, 0 );
+	int a1 = FFMIN( pBand->y1 + CONVERT_BAND_OVERLAP, m_params.hSrc );
+	int rows = a1 - a0;
+
+	int srcShiftX, srcShiftY, dstShiftX, dstShiftY;
+	avcodec_get_chroma_sub_sample( m_params.srcFmt, &srcShiftX, &srcShiftY );
+	avcodec_get_chroma_sub_sample( m_params.dstFmt, &dstShiftX, &dstShiftY );
+
+	const uint8_t* srcData[4];
+	for ( int i = 0; i < 4; ++i )
+	{
+		//Palette has no rows;
+		int shift = ( i == 1 || i == 2 ) ? srcShiftY : 0;
+		srcData[i] = m_pSrc->data[i];
+		if ( srcData[i] && m_pSrc->linesize[i] > 0 )
+			srcData[i] += ( a0 >> shift ) * m_pSrc->linesize[i];
+	}
+
+	size_t offsets[4];
+	size_t size = 0;
+	int tmpStride[4] = {0, 0, 0, 0};
+	for ( int i = 0; i < 4; ++i )
+	{
+		int shift = ( i == 1 || i == 2 ) ? dstShiftY : 0;
+		offsets[i] = size;
+		if ( m_dstData[i] )
+		{
+			tmpStride[i] = FFABS( m_dstStride[i] );
+			size += tmpStride[i] * (size_t)( -((-rows) >> shift) );
+		}
+	}
+
+	pBand->scratch.resize( size );
+
+	uint8_t* tmpData[4] = {NULL, NULL, NULL, NULL};
+	for ( int i = 0; i < 4; ++i )
+	{
+		if ( m_dstData[i] )
+			tmpData[i] = &pBand->scratch[0] + offsets[i];
+	}
+
+	VDFFScaleParams params = m_params;
+	params.hSrc = rows;
+	params.hDst = rows;
+
+	SwsContext* pSwsCtx = pBand->scalers.get( params );
+	if ( !pSwsCtx )
+	{
+		pBand->bFailed = true;
+		return;
+	}
+
+	sws_scale( pSwsCtx, srcData, m_pSrc->linesize, 0, rows, tmpData, tmpStride );
+
+	for ( int i = 0; i < 4; ++i )
+	{
+		if ( !m_dstData[i] )
+			continue;
+
+		int shift = ( i == 1 || i == 2 ) ? dstShiftY : 0;
+		int first = ( pBand->y0 - a0 ) >> shift;
+		int row = pBand->y0 >> shift;
+		int count = -((-pBand->y1) >> shift) - row;
+
+		for ( int y = 0; y < count; ++y )
+			memcpy( m_dstData[i] + (ptrdiff_t)( row + y ) * m_dstStride[i],
+				tmpData[i] + (size_t)( first + y ) * tmpStride[i], tmpStride[i] );
+	}
+}
+
+unsigned __stdcall VDFFBandConverter::workerThread( void* pParam )
+{
+	Band* pBand = (Band*)pParam;
+	pBand->pOwner->workerLoop( pBand );
+	return 0;
+}
+
+void VDFFBandConverter::workerLoop( Band* pBand )
+{
+	for (;;)
+	{
+		WaitForSingleObject( pBand->hWake, INFINITE );
+		if ( m_bExit )
+			break;
+
+		convertBand( pBand );
+		SetEvent( pBand->hDone );
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+struct VDFFRawFrame
+{
+	sint64						pos;
+	std::vector<uint8>			data;
+};
+
+typedef std::list<VDFFRawFrame>	TRawFrameList;
+
+class VDFFParallelDecoder;
+
+class VDFFVideoSource : public vdxunknown<IVDXStreamSource>, public IVDXVideoSource, public IVDXVideoDecoder, public IVDXVideoDecoderModel, public IVDFFThumbnailExtractor, public VDFFStreamBase 
+{
+public:
+	VDFFVideoSource(const VDXInputDriverContext& context);
+	~VDFFVideoSource();
+
+	int VDXAPIENTRY AddRef();
+	int VDXAPIENTRY Release();
+	void *VDXAPIENTRY AsInterface(uint32 iid);
+
+public:
+	//Stream Interface
+	void		VDXAPIENTRY GetStreamSourceInfo(VDXStreamSourceInfo&);
+	bool		VDXAPIENTRY Read(sint64 lStart, uint32 lCount, void *lpBuffer, uint32 cbBuffer, uint32 *lBytesRead, uint32 *lSamplesRead);
+
+	const void *VDXAPIENTRY GetDirectFormat();
+	int			VDXAPIENTRY GetDirectFormatLen();
+
+	ErrorMode VDXAPIENTRY GetDecodeErrorMode();
+	void VDXAPIENTRY SetDecodeErrorMode(ErrorMode mode);
+	bool VDXAPIENTRY IsDecodeErrorModeSupported(ErrorMode mode);
+
+	bool VDXAPIENTRY IsVBR();
+	sint64 VDXAPIENTRY TimeToPositionVBR(sint64 us);
+	sint64 VDXAPIENTRY PositionToTimeVBR(sint64 samples);
+
+	void VDXAPIENTRY GetVideoSourceInfo(VDXVideoSourceInfo& info);
+
+	bool VDXAPIENTRY CreateVideoDecoderModel(IVDXVideoDecoderModel **ppModel);
+	bool VDXAPIENTRY CreateVideoDecoder(IVDXVideoDecoder **ppDecoder);
+
+	void		VDXAPIENTRY GetSampleInfo(sint64 sample_num, VDXVideoFrameInfo& frameInfo);
+
+	bool		VDXAPIENTRY IsKey(sint64 lSample);
+
+	sint64		VDXAPIENTRY GetFrameNumberForSample(sint64 sample_num);
+	sint64		VDXAPIENTRY GetSampleNumberForFrame(sint64 display_num);
+	sint64		VDXAPIENTRY GetRealFrame(sint64 display_num);
+
+	sint64		VDXAPIENTRY GetSampleBytePosition(sint64 sample_num);
+
+public:
+	//Decoder Interface
+	const void *VDXAPIENTRY DecodeFrame(const void *inputBuffer, uint32 data_len, bool is_preroll, sint64 streamFrame, sint64 targetFrame);
+	uint32		VDXAPIENTRY GetDecodePadding();
+	void		VDXAPIENTRY Reset();
+	bool		VDXAPIENTRY IsFrameBufferValid();
+	const VDXPixmap& VDXAPIENTRY GetFrameBuffer();
+	bool		VDXAPIENTRY SetTargetFormat(int format, bool useDIBAlignment);
+	bool		VDXAPIENTRY SetDecompressedFormat(const VDXBITMAPINFOHEADER *pbih);
+
+	const void *VDXAPIENTRY GetFrameBufferBase();
+	bool		VDXAPIENTRY IsDecodable(sint64 sample_num);
+
+public:
+	//Model Interface
+	//void	VDXAPIENTRY Reset();
+	void	VDXAPIENTRY SetDesiredFrame(sint64 frame_num);
+	sint64	VDXAPIENTRY GetNextRequiredSample(bool& is_preroll);
+	int		VDXAPIENTRY GetRequiredCount();
+
+public:
+	//Thumbnails Interface
+	int		VDXAPIENTRY ExtractThumbnails(const sint64 *pTimes, int count, int width, int height, void *pBuffer, ptrdiff_t pitch, bool *pExtracted);
+
+public:
+	//Internal
+	int			initStream( IFFSource* pSource, int indexStream, VDFFOptions* pOpts );
+	void		invalidateBuffer( void );
+	void		notifySeek( int64 timestamp );
+
+	sint64		getPts(  AVPacket* pPacket );
+
+	//Nearest keyframe at or before sample (sample itself if unknown);
+	sint64		getKeyFrame( sint64 sample );
+	//Keyframes listed by demuxer index, fails if index doesn't cover stream;
+	bool		getIndexKeyFrames( std::vector<sint64>& keyFrames );
+
+	uint32		prepareFrameBuffer( AVPicture* p, int format, void* pFrameBuffer );
+	//Raw decoded frame to target format in pixmap layout at pFrameBuffer;
+	uint32		convertFrame( uint8* pRaw, void* pFrameBuffer );
+	//Frame of decode-ahead ring;
+	struct AheadFrame
+	{
+		sint64						pos;
+		//Decoded picture, or whole frame buffer in pixmap layout if converted;
+		std::vector<uint8>			data;
+		bool						bConverted;
+		int							format;
+		//Layout of pixmap when converted, see m_layoutGeneration;
+		uint32						layout;
+		bool						bDraft;
+		//Scaler flags of conversion;
+		int							flags;
+		//Hash of decoded picture for duplicates, 0 - unknown;
+		uint64						hash;
+	};
+
+	//Convert decoded frame into frame buffer of decode-ahead ring (source must be locked);
+	bool		convertAheadFrame( AheadFrame& frame );
+	//Converted frame of sample handed over by Read becomes frame buffer (m_csOutput must be held);
+	bool		takeConvertedFrame( sint64 sample, int flags );
+	//Frame buffer vector was replaced, pixmap planes follow its base;
+	void		rebaseFrameBuffer( void );
+	//Own kernels for common 4:2:0 to RGB without scaling;
+	bool		convertUnscaledRGB( AVPicture* pPicture, PixelFormat srcFmt, uint8_t* pDst, int pitchDst, int bytesPerPixel );
+	//Convert decoded frame to pixmap size, in bands if possible;
+	void		scaleFrame( AVPicture* pPicture, PixelFormat srcFmt, PixelFormat dstFmt, int flags, uint8_t* dstData[4], int dstStride[4] );
+	//Decoded frame is already in target format and size;
+	bool		isPassthrough( int format ) const;
+	//Sample is converted to target format in frame buffer or output cache;
+	bool		isConverted( sint64 sample, bool bPin = false );
+	//Scaler flags of current access pattern, decimation not done by decoder goes through fast filter;
+	int			scaleFlags( void ) const;
+	//Scaler flags converted frame depends on, 0 - plain copy of decoder planes;
+	int			convertFlags( void ) const;
+	//Frame buffer holds conversion of current target format, decoder quality and scaler (m_csOutput must be held);
+	bool		isBufferCurrent( void ) const;
+	//Track access pattern of real reads, switch decoder quality while scrubbing;
+	void		updateAccess( sint64 pos );
+	bool		decodeFramePacket( AVFrame* pFrame, AVPacket* pPacket );
+	//Decode stream up to sample, result is left in m_currentBuffer (source must be locked);
+	bool		decodeToSample( sint64 sample );
+	//Every frame is independent: seek exactly, skip packets, decode sample only;
+	bool		decodeIntraSample( sint64 sample );
+	bool		detectIntraOnly( void ) const;
+	int64		guessPts( AVPacket* pPacket );
+
+	//Convert frame number to timestamp;
+	int64		pos2ts( sint64 num ) const;
+
+	sint64		ts2pos( int64 ts ) const;
+
+	void		initTimecodes( byte mode, int64 duration );
+
+	//Decode-ahead thread;
+	bool		startDecodeAhead( void );
+	void		stopDecodeAhead( void );
+	//Frame decoded ahead for sample or NULL (cancels decode-ahead), m_csAhead must be held;
+	AheadFrame*	queryAheadFrame( sint64 sample );
+	void		popAheadFrame( void );
+	void		cancelDecodeAhead( void );
+	void		decodeAheadLoop( void );
+	static unsigned __stdcall decodeAheadThread( void* pParam );
+
+	//Parallel decoding of following segments;
+	bool		startParallel( sint64 sample );
+
+
+private:
+	const VDXInputDriverContext&	mContext;
+	AVFormatContext					*m_pFormatCtx;
+	AVStream						*m_pStreamCtx;
+	AVCodecContext					*m_pCodecCtx;
+
+	VDFFScalerTable					m_scalers;
+	VDFFBandConverter				m_converter;
+	VDXStreamSourceInfo				m_streamInfo;
+
+	VDXPixmap						m_pixmap;
+	//Buffer for pixmap, planes start at aligned base;
+	std::vector<uint8>				m_frameBuffer;
+	uint8*							m_pFrameBase;
+	uint32							m_frameSize;
+	//Converter destination planes from frame base (Y8 includes scratch chroma behind pixmap),
+	//stride 0 - no plane;
+	ptrdiff_t						m_planeOffset[3];
+	int								m_planeStride[3];
+	//Bottom-up (DIB) layout of RGB pixmap;
+	bool							m_bFlipBuffer;
+	byte							m_bAlignedRows;
+	//Changed with format or orientation of pixmap;
+	uint32							m_layoutGeneration;
+	byte							m_bFusedConvert;
+	//Scaler flags for random access and sequential frames;
+	int								m_previewScaleFlags;
+	int								m_exportScaleFlags;
+	//Buffers of two sequenced frames;  
+	std::vector<uint8>				m_currentBuffer;
+	std::vector<uint8>				m_nextBuffer;
+	//8-bit copy of high bit depth frame for conversions without own kernel;
+	std::vector<uint8>				m_reducedBuffer;
+	AVPicture						m_reducedPicture;
+	AVFrame							m_avframe;
+	int								m_fmtBuffer;
+	//Frame buffer holds frame of draft decode;
+	bool							m_bDraftBuffer;
+	//Scaler flags of frame buffer conversion;
+	int								m_flagsBuffer;
+	VDFFOutputCache					m_outputCache;
+
+	sint64							m_posDecode;
+	//Guards output cache and state of frame buffer, Read checks them on I/O thread
+	//while DecodeFrame converts on processing thread;
+	CRITICAL_SECTION				m_csOutput;
+	bool							m_bResetDecoder;
+	
+private:
+	//Decoder model state: last scheduled sample and samples handed out as preroll;
+	sint64							m_posDesired;
+	sint64							m_posModel;
+	std::set<sint64>				m_prerollSamples;
+
+private:
+	sint64							m_posCurrent;
+	sint64							m_posNext;
+	//Threshold for seek (without keyframe index);
+	sint64							m_posDelta;
+	sint64							m_posDesync;
+	bool							m_bStreamSeeked;
+	//Timestamps of packets in decoder;
+	VDFFReorderWindow				m_reorder;
+	//Measured time of decoded packet and of seek (counter ticks);
+	double							m_decodeTime;
+	double							m_seekTime;
+
+private:
+	byte							m_bAdjustPAR;
+	//Decode keyframes only, other frames show preceding keyframe;
+	byte							m_bKeyframesOnly;
+	//Stream holds keyframes only (MJPEG, DV, ProRes...);
+	bool							m_bIntraOnly;
+	//Reduced size wasn't reached by decoder lowres;
+	bool							m_bDecimate;
+	byte							m_bDraftDecode;
+	bool							m_bDraftActive;
+	//Decoder references come from draft decode, full quality decode starts at keyframe;
+	bool							m_bDraftFlush;
+	//Last real reads jump around quickly;
+	bool							m_bScrubbing;
+	sint64							m_posLastRead;
+	DWORD							m_tickLastRead;
+	int64							m_tsStart;
+	//Rate of constant mapping (or average rate of timecodes);
+	AVRational						m_frameRate;
+	VDFFTimecodes					m_timecodes;
+	VDFFDuplicates					m_duplicates;
+
+private:
+	//Ring of frames decoded ahead, guarded by m_csAhead;
+	HANDLE							m_hAheadThread;
+	//Signaled on new work or free slot in ring;
+	HANDLE							m_hAheadWake;
+	//Signaled on decoded frame or decode-ahead stop;
+	HANDLE							m_hAheadReady;
+	CRITICAL_SECTION				m_csAhead;
+	AheadFrame						m_aheadFrames[MAX_DECODE_AHEAD];
+	int								m_aheadFirst;
+	int								m_aheadCount;
+	//Converted frames marked by Read, waiting for DecodeFrame;
+	std::list<AheadFrame>			m_convertedFrames;
+	//Frame buffers given back by DecodeFrame, reused by ring;
+	std::vector< std::vector<uint8> >	m_spareBuffers;
+	//Next sample for thread to decode;
+	sint64							m_posAhead;
+	//Changed on cancel, frames decoded for old generation are dropped;
+	uint32							m_aheadGeneration;
+	bool							m_bAheadActive;
+	bool							m_bAheadExit;
+	//Last sample returned by Read;
+	sint64							m_posAheadLast;
+
+	byte							m_bParallelDecode;
+	VDFFParallelDecoder				*m_pParallel;
+	//Sample in m_parallelBuffer;
+	sint64							m_posParallel;
+	std::vector<uint8>				m_parallelBuffer;
+
+	struct PoolCursor
+	{
+		VDFFDecoderCursor			cursor;
+		//Last frame at or before requested sample;
+		VDFFRawFrame				current;
+		//Frame decoded past requested sample;
+		VDFFRawFrame				pending;
+		uint32						lastUsed;
+		//References decoded in draft quality;
+		bool						bDraft;
+	};
+
+	//Decoder pool, NULL stands for source decoder;
+	PoolCursor*	pickCursor( sint64 sample );
+	bool		decodeCursorSample( PoolCursor* pCursor, sint64 sample );
+	//Frames to decode from source decoder position;
+	sint64		sourceDecodeCost( sint64 sample );
+	sint64		seekDecodeCost( sint64 sample );
+	//Seek if decoding forward from current position costs more;
+	bool		isSeekCheaper( sint64 sample );
+
+	byte							m_bDecoderPool;
+	std::vector<PoolCursor*>		m_cursorPool;
+	uint32							m_poolCounter;
+	uint32							m_sourceLastUsed;
+	//Playback and export stay on source decoder;
+	sint64							m_posLastTarget;
+	int								m_nSequentialTargets;
+	
+};
+
+///////////////////////////////////////////////////////////////////////////////
+bool VDFFDuplicates::scanFile( void )
+{
+	const char* filename = m_filename.c_str();
+	int indexStream = m_indexStream;
+	sint64 count = m_count;
+	bool bIntraOnly = m_bIntraOnly;
+
+	//Packets only, stream info would open codecs concurrently with source;
+	AVFormatContext *pFormatCtx = NULL;
+	if ( avformat_open_input( &pFormatCtx, filename, NULL, NULL ) != 0 )
+		return false;
+
+	std::vector<uint32> sizes( (size_t)count, 0 );
+	std::vector<uint64> hashes( (size_t)count, 0 );
+	std::vector<bool> keys( (size_t)count, true );
+	uint64 total = 0;
+	uint32 packets = 0;
+
+	AVPacket packet;
+	av_init_packet( &packet );
+
+	while ( !m_bCancel && av_read_frame( pFormatCtx, &packet ) >= 0 )
+	{
+		int64 ts = ( packet.pts != AV_NOPTS_VALUE ) ? packet.pts : packet.dts;
+
+		if ( packet.stream_index == indexStream && ts != AV_NOPTS_VALUE && packet.size > 0 )
+		{
+			sint64 pos = ts2pos( ts );
+			if ( pos >= 0 && pos < count )
+			{
+				sizes[(size_t)pos] = packet.size;
+				hashes[(size_t)pos] = VDFFHash( packet.data, packet.size );
+				keys[(size_t)pos] = ( packet.flags & AV_PKT_FLAG_KEY ) != 0;
+			}
+			total += packet.size;
+			++packets;
+		}
+		av_free_packet( &packet );
+	}
+
+	av_close_input_file( pFormatCtx );
+
+	if ( m_bCancel || packets == 0 )
+		return false;
+
+	uint64 average = total / packets;
+
+	m_state.resize( (size_t)count, kUnknown );
+	m_hashes.resize( (size_t)count, 0 );
+
+	bool bFound = false;
+	for ( size_t i = 1; i < (size_t)count; ++i )
+	{
+		if ( sizes[i] == 0 || sizes[i - 1] == 0 )
+			continue;
+
+		bool bSame = sizes[i] == sizes[i - 1] && hashes[i] == hashes[i - 1];
+		
+		//Same independent packet gives same picture;
+		if ( bSame && bIntraOnly )
+			m_state[i] = kDuplicate;
+		//Delta frame repeating packet or coding nothing but skips;
+		else if ( bSame || ( !keys[i] && sizes[i] * DUPLICATE_PACKET_RATIO < average ) )
+			m_state[i] = kCandidate;
+		else
+			continue;
+
+		bFound = true;
+	}
+
+	if ( !bFound )
+		clear();
+
+	return bFound;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//Splits stream into segments starting at keyframes, each worker owns cursor
+//and decodes every K-th segment, reader takes frames back in display order;
+class VDFFParallelDecoder
+{
+public:
+	VDFFParallelDecoder( VDFFVideoSource* pSource, int workers, uint32 frameSize, sint64 sampleCount );
+	~VDFFParallelDecoder();
+
+	//Start decoding from segment holding sample, fails if stream can't be split;
+	bool	start( sint64 sample );
+	void	stop( void );
+	bool	isActive( void ) const { return m_bActive; }
+
+	//Copy of decoded sample, fails if sample isn't just ahead of reader;
+	bool	getFrame( sint64 sample, std::vector<uint8>& buffer );
+
+protected:
+	struct Worker
+	{
+		VDFFParallelDecoder*	pOwner;
+		int						index;
+		VDFFDecoderCursor		cursor;
+		HANDLE					hThread;
+		//Signaled on new segments or free space in frames;
+		HANDLE					hWake;
+		TRawFrameList			frames;
+		//Last frame passed by reader, shown for missing samples;
+		TRawFrameList			held;
+		//Segment being decoded;
+		int						segment;
+		bool					bFailed;
+	};
+
+	bool	init( void );
+	void	recycle( TRawFrameList& frames );
+	int		findSegment( sint64 sample ) const;
+	void	workerLoop( Worker* pWorker );
+	static unsigned __stdcall workerThread( void* pParam );
+
+protected:
+	VDFFVideoSource*			m_pSource;
+	int							m_nWorkers;
+	uint32						m_frameSize;
+	sint64						m_sampleCount;
+	//Frames per worker kept in memory;
+	size_t						m_capacity;
+
+	std::vector<Worker*>		m_workers;
+	std::vector<sint64>			m_keyFrames;
+	//Segment starts followed by end of stream;
+	std::vector<sint64>			m_segments;
+	TRawFrameList				m_spare;
+
+	CRITICAL_SECTION			m_cs;
+	//Signaled on decoded frame or finished segment;
+	HANDLE						m_hReady;
+	uint32						m_generation;
+	int							m_readSegment;
+	sint64						m_posRead;
+	bool						m_bInit;
+	bool						m_bActive;
+	bool						m_bExit;
+};
+
+VDFFParallelDecoder::VDFFParallelDecoder( VDFFVideoSource* pSource, int workers, uint32 frameSize, sint64 sampleCount ):
+	m_pSource( pSource ),
+	m_nWorkers( workers ),
+	m_frameSize( frameSize ),
+	m_sampleCount( sampleCount ),
+	m_hReady( NULL ),
+	m_generation( 0 ),
+	m_readSegment( 0 ),
+	m_posRead( -1 ),
+	m_bInit( false ),
+	m_bActive( false ),
+	m_bExit( false )
+{
+	InitializeCriticalSection( &m_cs );
+
+	m_capacity = PARALLEL_MEMORY_BUDGET / ( m_nWorkers * FFMAX( m_frameSize, 1 ) );
+	m_capacity = FFMAX( m_capacity, MAX_DECODE_AHEAD );
+}
+
+VDFFParallelDecoder::~VDFFParallelDecoder()
+{
+	EnterCriticalSection( &m_cs );
+	m_bExit = true;
+	m_bActive = false;
+	++m_generation;
+	for ( size_t i = 0; i < m_workers.size(); ++i )
+		SetEvent( m_workers[i]->hWake );
+	LeaveCriticalSection( &m_cs );
+
+	for ( size_t i = 0; i < m_workers.size(); ++i )
+	{
+		Worker* pWorker = m_workers[i];
+		if ( pWorker->hThread )
+		{
+			WaitForSingleObject( pWorker->hThread, INFINITE );
+			CloseHandle( pWorker->hThread );
+		}
+		CloseHandle( pWorker->hWake );
+		delete pWorker;
+	}
+
+	if ( m_hReady )
+		CloseHandle( m_hReady );
+
+	DeleteCriticalSection( &m_cs );
+}
+
+bool VDFFParallelDecoder::init( void )
+{
+	AVFormatContext* pFormatCtx = m_pSource->getSource()->getContext();
+	int indexStream = m_pSource->getIndex();
+
+	m_hReady = CreateEvent( NULL, FALSE, FALSE, NULL );
+	if ( !m_hReady )
+		return false;
+
+	for ( int i = 0; i < m_nWorkers; ++i )
+	{
+		Worker* pWorker = new Worker;
+		pWorker->pOwner = this;
+		pWorker->index = i;
+		pWorker->hThread = NULL;
+		pWorker->hWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+		pWorker->segment = -1;
+		pWorker->bFailed = false;
+		m_workers.push_back( pWorker );
+
+		//Decoders are opened here, avcodec_open isn't thread safe;
+		if ( !pWorker->hWake || 
+			!pWorker->cursor.open( pFormatCtx->filename, indexStream, pFormatCtx->streams[indexStream]->codec->lowres ) )
+			return false;
+	}
+
+	//Demuxers index is missing or built while reading, find keyframes by own pass;
+	if ( !m_pSource->getIndexKeyFrames( m_keyFrames ) )
+	{
+		std::vector<int64> timestamps;
+		if ( !m_workers[0]->cursor.scanKeyFrames( timestamps ) )
+			return false;
+
+		m_keyFrames.clear();
+		for ( size_t i = 0; i < timestamps.size(); ++i )
+			m_keyFrames.push_back( m_pSource->ts2pos( timestamps[i] ) );
+	}
+
+	if ( m_keyFrames.empty() )
+		return false;
+
+	for ( size_t i = 0; i < m_workers.size(); ++i )
+	{
+		Worker* pWorker = m_workers[i];
+		pWorker->hThread = (HANDLE)_beginthreadex( NULL, 0, workerThread, pWorker, 0, NULL );
+		if ( !pWorker->hThread )
+			return false;
+	}
+
+	return true;
+}
+
+bool VDFFParallelDecoder::start( sint64 sample )
+{
+	if ( !m_bInit )
+	{
+		m_bInit = true;
+		if ( !init() )
+		{
+			//Disabled for good;
+			m_keyFrames.clear();
+		}
+	}
+
+	if ( m_keyFrames.empty() )
+		return false;
+
+	std::vector<sint64>::const_iterator it = std::upper_bound( m_keyFrames.begin(), m_keyFrames.end(), sample );
+	if ( it == m_keyFrames.begin() )
+		return false;
+
+	EnterCriticalSection( &m_cs );
+
+	++m_generation;
+
+	//Merge short GOPs, every segment costs a seek;
+	m_segments.clear();
+	m_segments.push_back( *(it - 1) );
+	for ( ; it != m_keyFrames.end(); ++it )
+	{
+		if ( *it >= m_segments.back() + PARALLEL_MIN_SEGMENT && *it < m_sampleCount )
+			m_segments.push_back( *it );
+	}
+	m_segments.push_back( m_sampleCount );
+
+	for ( size_t i = 0; i < m_workers.size(); ++i )
+	{
+		Worker* pWorker = m_workers[i];
+		recycle( pWorker->frames );
+		recycle( pWorker->held );
+		pWorker->segment = (int)i;
+		pWorker->bFailed = false;
+		SetEvent( pWorker->hWake );
+	}
+
+	m_readSegment = 0;
+	m_posRead = sample;
+	m_bActive = true;
+
+	LeaveCriticalSection( &m_cs );
+	return true;
+}
+
+void VDFFParallelDecoder::stop( void )
+{
+	EnterCriticalSection( &m_cs );
+
+	++m_generation;
+	m_bActive = false;
+
+	for ( size_t i = 0; i < m_workers.size(); ++i )
+	{
+		recycle( m_workers[i]->frames );
+		recycle( m_workers[i]->held );
+		SetEvent( m_workers[i]->hWake );
+	}
+
+	LeaveCriticalSection( &m_cs );
+}
+
+void VDFFParallelDecoder::recycle( TRawFrameList& frames )
+{
+	m_spare.splice( m_spare.end(), frames );
+}
+
+int VDFFParallelDecoder::findSegment( sint64 sample ) const
+{
+	if ( m_segments.empty() || sample < m_segments.front() || sample >= m_segments.back() )
+		return -1;
+
+	return (int)( std::upper_bound( m_segments.begin(), m_segments.end(), sample ) - m_segments.begin() ) - 1;
+}
+
+bool VDFFParallelDecoder::getFrame( sint64 sample, std::vector<uint8>& buffer )
+{
+	EnterCriticalSection( &m_cs );
+
+	bool bResult = false;
+	int segment = findSegment( sample );
+
+	//Only segments handed out to workers are ahead of reader;
+	if ( m_bActive && segment >= 0 && sample >= m_posRead &&
+		segment >= m_readSegment && segment < m_readSegment + (int)m_workers.size() )
+	{
+		Worker* pWorker = m_workers[segment % m_workers.size()];
+
+		for (;;)
+		{
+			//Drop frames skipped by reader, keep last one;
+			while ( !pWorker->frames.empty() && pWorker->frames.front().pos < sample )
+			{
+				recycle( pWorker->held );
+				pWorker->held.splice( pWorker->held.end(), pWorker->frames, pWorker->frames.begin() );
+				SetEvent( pWorker->hWake );
+			}
+
+			if ( pWorker->bFailed )
+				break;
+
+			if ( !pWorker->frames.empty() && pWorker->frames.front().pos == sample )
+			{
+				buffer = pWorker->frames.front().data;
+				bResult = true;
+				break;
+			}
+
+			//Sample is missing in stream, show preceding frame;
+			if ( !pWorker->frames.empty() || pWorker->segment > segment )
+			{
+				if ( !pWorker->held.empty() && pWorker->held.front().pos >= m_segments[segment] )
+				{
+					buffer = pWorker->held.front().data;
+					bResult = true;
+				}
+				else if ( !pWorker->frames.empty() && pWorker->frames.front().pos < m_segments[segment + 1] )
+				{
+					buffer = pWorker->frames.front().data;
+					bResult = true;
+				}
+				break;
+			}
+
+			LeaveCriticalSection( &m_cs );
+			WaitForSingleObject( m_hReady, INFINITE );
+			EnterCriticalSection( &m_cs );
+		}
+	}
+
+	if ( bResult )
+	{
+		m_posRead = sample;
+		m_readSegment = segment;
+	}
+
+	LeaveCriticalSection( &m_cs );
+	return bResult;
+}
+
+unsigned __stdcall VDFFParallelDecoder::workerThread( void* pParam )
+{
+	Worker* pWorker = (Worker*)pParam;
+	pWorker->pOwner->workerLoop( pWorker );
+	return 0;
+}
+
+void VDFFParallelDecoder::workerLoop( Worker* pWorker )
+{
+	TRawFrameList frame;
+
+	EnterCriticalSection( &m_cs );
+
+	for (;;)
+	{
+		while ( !m_bExit && ( !m_bActive || pWorker->bFailed || 
+			pWorker->segment < 0 || pWorker->segment + 1 >= (int)m_segments.size() ) )
+		{
+			LeaveCriticalSection( &m_cs );
+			WaitForSingleObject( pWorker->hWake, INFINITE );
+			EnterCriticalSection( &m_cs );
+		}
+
+		if ( m_bExit )
+			break;
+
+		uint32 generation = m_generation;
+		sint64 posStart = m_segments[pWorker->segment];
+		sint64 posEnd = m_segments[pWorker->segment + 1];
+
+		LeaveCriticalSection( &m_cs );
+
+		bool bFailed = !pWorker->cursor.seek( m_pSource->pos2ts( posStart ) );
+		bool bCancel = false;
+		sint64 pos = posStart - 1;
+
+		while ( !bFailed && !bCancel )
+		{
+			if ( frame.empty() )
+			{
+				EnterCriticalSection( &m_cs );
+				if ( m_spare.empty() )
+					frame.push_back( VDFFRawFrame() );
+				else
+					frame.splice( frame.end(), m_spare, m_spare.begin() );
+				LeaveCriticalSection( &m_cs );
+			}
+
+			int64 timestamp;
+			if ( !pWorker->cursor.decodeNext( frame.front().data, timestamp ) )
+				break;
+
+			//Cursor decoder doesn't match source;
+			if ( frame.front().data.size() != m_frameSize )
+			{
+				bFailed = true;
+				break;
+			}
+
+			pos = ( timestamp != AV_NOPTS_VALUE ) ? m_pSource->ts2pos( timestamp ) : pos + 1;
+
+			//Leading frames of open GOP belong to preceding segment;
+			if ( pos < posStart )
+				continue;
+			if ( pos >= posEnd )
+				break;
+
+			frame.front().pos = pos;
+
+			EnterCriticalSection( &m_cs );
+
+			while ( generation == m_generation && pWorker->frames.size() >= m_capacity )
+			{
+				LeaveCriticalSection( &m_cs );
+				WaitForSingleObject( pWorker->hWake, INFINITE );
+				EnterCriticalSection( &m_cs );
+			}
+
+			bCancel = ( generation != m_generation );
+			if ( !bCancel )
+			{
+				pWorker->frames.splice( pWorker->frames.end(), frame );
+				SetEvent( m_hReady );
+			}
+
+			LeaveCriticalSection( &m_cs );
+		}
+
+		EnterCriticalSection( &m_cs );
+
+		if ( generation == m_generation )
+		{
+			pWorker->bFailed = bFailed;
+			pWorker->segment += (int)m_workers.size();
+			SetEvent( m_hReady );
+		}
+	}
+
+	recycle( frame );
+	LeaveCriticalSection( &m_cs );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+VDFFVideoSource::VDFFVideoSource(const VDXInputDriverContext& context):
+VDFFStreamBase( AVMEDIA_TYPE_VIDEO ),
+	m_posDecode( -1 ),
+	m_posDesired(-1),
+	m_posModel(-1),
+	m_pFormatCtx( NULL ),
+	m_pStreamCtx( NULL ),
+	m_pCodecCtx( NULL ),
+	m_posNext(-1),
+	m_tsStart( 0 ),
+	m_bStreamSeeked(false),
+	m_fmtBuffer( 0 ),
+	m_bDraftBuffer( false ),
+	m_flagsBuffer( 0 ),
+	m_pFrameBase( NULL ),
+	m_frameSize( 0 ),
+	m_bFlipBuffer( false ),
+	m_bAlignedRows( 0 ),
+	m_layoutGeneration( 0 ),
+	m_bFusedConvert( 0 ),
+	m_previewScaleFlags( SWS_FAST_BILINEAR ),
+	m_exportScaleFlags( SWS_BICUBIC ),
+	m_hAheadThread( NULL ),
+	m_hAheadWake( NULL ),
+	m_hAheadReady( NULL ),
+	m_aheadFirst( 0 ),
+	m_aheadCount( 0 ),
+	m_posAhead( -1 ),
+	m_aheadGeneration( 0 ),
+	m_bAheadActive( false ),
+	m_bAheadExit( false ),
+	m_posAheadLast( -1 ),
+	m_bIntraOnly( false ),
+	m_bParallelDecode( 0 ),
+	m_pParallel( NULL ),
+	m_posParallel( -1 ),
+	m_bDecoderPool( 0 ),
+	m_poolCounter( 0 ),
+	m_sourceLastUsed( 0 ),
+	m_posLastTarget( -1 ),
+	m_nSequentialTargets( 0 ),
+	mContext(context)
+{
+	InitializeCriticalSection( &m_csAhead );
+	InitializeCriticalSection( &m_csOutput );
+}
+
+VDFFVideoSource::~VDFFVideoSource() 
+{
+	m_duplicates.stopScan();
+	stopDecodeAhead();
+	DeleteCriticalSection( &m_csAhead );
+	DeleteCriticalSection( &m_csOutput );
+
+	delete m_pParallel;
+
+	for ( size_t i = 0; i < m_cursorPool.size(); ++i )
+		delete m_cursorPool[i];
+
+	if ( m_pCodecCtx )
+		// Close the codec
+		avcodec_close(m_pCodecCtx);
+}
+
+
+int VDFFVideoSource::AddRef() {
+	return vdxunknown<IVDXStreamSource>::AddRef();
+}
+
+int VDFFVideoSource::Release() {
+	return vdxunknown<IVDXStreamSource>::Release();
+}
+
+void *VDXAPIENTRY VDFFVideoSource::AsInterface(uint32 iid)
+{
+	if (iid == IVDXVideoSource::kIID)
+		return static_cast<IVDXVideoSource *>(this);
+
+	if (iid == IVDFFThumbnailExtractor::kIID)
+		return static_cast<IVDFFThumbnailExtractor *>(this);
+
+	return vdxunknown<IVDXStreamSource>::AsInterface(iid);
+}
+
+
+
+static int VDFFScalerFlags( byte scaler, byte bAccurateRnd )
+{
+	int flags = SWS_BICUBIC;
+
+	switch ( scaler )
+	{
+	case VDFFOptions::kScalerFastBilinear:
+		flags = SWS_FAST_BILINEAR;
+		break;
+	case VDFFOptions::kScalerBilinear:
+		flags = SWS_BILINEAR;
+		break;
+	case VDFFOptions::kScalerLanczos:
+		flags = SWS_LANCZOS;
+		break;
+	}
+
+	if ( bAccurateRnd )
+		flags |= SWS_ACCURATE_RND;
+
+	return flags;
+}
+
+int VDFFVideoSource::initStream( IFFSource* pSource, int streamIndex, VDFFOptions* pOpts )
+{
+	int result = VDFFStreamBase::initStream( pSource, streamIndex );
+	if ( result < 0 )
+		return result;
+
+	m_pFormatCtx = pSource->getContext();
+	m_pStreamCtx = m_pFormatCtx->streams[getIndex()];
+	m_pCodecCtx = m_pStreamCtx->codec;
+
+	//TODO:
+	//framerate = 1.0/(m_pCodecCtx->ticks_per_frame * m_pCodecCtx->time_base)
+	// Find the decoder for the video stream
+	AVCodec* pDecoder = avcodec_find_decoder(m_pCodecCtx->codec_id);
+	if( pDecoder==NULL ) return -1; // Codec not found
+
+	int width = m_pCodecCtx->width;
+	int height = m_pCodecCtx->height;
+
+	//Let decoder reduce resolution where it can;
+	int lowres = FFMIN( pOpts->bLowres, 3 );
+	m_pCodecCtx->lowres = FFMIN( lowres, pDecoder->max_lowres );
+	m_bDecimate = lowres > m_pCodecCtx->lowres;
+
+	// Open codec
+	if(avcodec_open(m_pCodecCtx, pDecoder)<0)	return -1;
+
+	width = -((-width) >> lowres);
+	height = -((-height) >> lowres);
+
+	m_tsStart = 0;
+	m_frameRate = m_pStreamCtx->r_frame_rate;
+
+	int64 duration = m_pStreamCtx->duration;
+	if ( duration == AV_NOPTS_VALUE )
+		duration = m_pFormatCtx->duration * m_pStreamCtx->time_base.den / ( m_pStreamCtx->time_base.num * AV_TIME_BASE );
+
+	m_streamInfo.mSampleCount = this->ts2pos( duration );
+
+	if ( m_pStreamCtx->start_time == AV_NOPTS_VALUE )
+		m_tsStart = m_pFormatCtx->start_time * m_pStreamCtx->time_base.den / ( m_pStreamCtx->time_base.num * AV_TIME_BASE );
+	else
+		m_tsStart = m_pStreamCtx->start_time;
+
+	if ( pOpts->bTimecodes != VDFFOptions::kTimecodesNone )
+		initTimecodes( pOpts->bTimecodes, duration );
+
+	m_streamInfo.mSampleRate.mNumerator = m_frameRate.num;
+	m_streamInfo.mSampleRate.mDenominator = m_frameRate.den;
+
+	m_streamInfo.mPixelAspectRatio.mNumerator =  1;
+	m_streamInfo.mPixelAspectRatio.mDenominator = 1;
+
+	m_bAdjustPAR = pOpts->bAdjustPAR;
+
+	m_bKeyframesOnly = pOpts->bKeyframesOnly;
+	if ( m_bKeyframesOnly )
+		m_pCodecCtx->skip_frame = AVDISCARD_NONKEY;
+
+	m_bIntraOnly = detectIntraOnly();
+
+	if ( pOpts->bDuplicates && !m_bKeyframesOnly )
+	{
+		double rate = m_frameRate.num *(double)m_pStreamCtx->time_base.num /( m_frameRate.den *(double)m_pStreamCtx->time_base.den );
+		m_duplicates.startScan( m_pFormatCtx->filename, getIndex(), m_timecodes, m_tsStart, rate, m_streamInfo.mSampleCount, m_bIntraOnly );
+	}
+
+	m_bDraftDecode = pOpts->bDraftDecode;
+	m_bDraftActive = false;
+	m_bDraftFlush = false;
+	m_bScrubbing = false;
+	m_posLastRead = -1;
+	m_tickLastRead = 0;
+
+	int numAR = 1;
+	int denAR = 1;
+	
+	if ( m_pStreamCtx->sample_aspect_ratio.num )
+	{
+		numAR =  m_pStreamCtx->sample_aspect_ratio.num;
+		denAR = m_pStreamCtx->sample_aspect_ratio.den;
+	}
+	else if ( m_pCodecCtx->sample_aspect_ratio.num )
+	{
+		numAR =  m_pCodecCtx->sample_aspect_ratio.num;
+		denAR = m_pCodecCtx->sample_aspect_ratio.den;
+	}
+
+	if ( !m_bAdjustPAR )
+	{
+		m_streamInfo.mPixelAspectRatio.mNumerator =  numAR;
+		m_streamInfo.mPixelAspectRatio.mDenominator = denAR;
+
+	}
+
+	m_pixmap.w =  width;
+	m_pixmap.h =  height;
+
+	if ( m_bAdjustPAR )
+	{
+		double dar = numAR/
+			(double)denAR;
+
+		//double par = m_pCodecCtx->width/
+		//	(double)m_pCodecCtx->height;
+
+		if ( dar > 1 )
+			m_pixmap.w = (int)(width * dar + 0.5);
+		else if ( dar < 1 )
+			m_pixmap.h =  (int)(height / dar + 0.5);
+
+	
+	}
+	
+	m_frameBuffer.reserve( m_pixmap.w * m_pixmap.h * 4);
+	m_currentBuffer.reserve(   m_pixmap.w * m_pixmap.h * 4 );
+	m_nextBuffer.reserve(   m_pixmap.w * m_pixmap.h * 4 );
+
+	m_currentBuffer.resize(1);
+	m_nextBuffer.resize(1);
+
+	avcodec_get_frame_defaults( &m_avframe );
+
+	m_posDelta = MAX_PACKETS_DELTA;
+	m_posDesync = (sint64)(MAX_DESYNC_TIME * av_q2d( m_frameRate ) + 0.5);
+	m_decodeTime = 0;
+	m_seekTime = 0;
+
+	//Register source;
+	if ( !this->getSource()->setStream( this ) )
+		return -1;
+	m_posCurrent = 0;
+	m_posNext = m_posCurrent;
+
+	m_bStreamSeeked = true;
+	//Load first frame;
+	uint32 cnt, bytes;
+	this->Read( 0, 1, NULL, 0, &bytes, &cnt );
+
+	if ( pOpts->bDecodeAhead )
+		startDecodeAhead();
+
+	//Keyframes only stream has nothing to decode between keyframes,
+	//intra-only stream is split into fixed size segments;
+	m_bParallelDecode = pOpts->bParallelDecode && ( !m_bKeyframesOnly || m_bIntraOnly );
+
+	//Seek is as cheap as any decode;
+	m_bDecoderPool = pOpts->bDecoderPool && !m_bKeyframesOnly && !m_bIntraOnly;
+
+	m_bAlignedRows = pOpts->bAlignedRows;
+	m_bFusedConvert = pOpts->bFusedConvert;
+
+	m_previewScaleFlags = VDFFScalerFlags( pOpts->bPreviewScaler, pOpts->bAccurateRnd );
+	m_exportScaleFlags = VDFFScalerFlags( pOpts->bExportScaler, pOpts->bAccurateRnd );
+
+	return result;
+}
+
+void VDFFVideoSource::initTimecodes( byte mode, int64 duration )
+{
+	if ( mode != VDFFOptions::kTimecodesFrame )
+		return;
+
+	AVRational avgRate = m_pStreamCtx->avg_frame_rate;
+	double rate = av_q2d( m_pStreamCtx->r_frame_rate );
+
+	//Rates disagree on variable frame rate sources, constant rate mapping is exact otherwise;
+	bool bVariable = !avgRate.num || !avgRate.den ||
+		fabs( av_q2d( avgRate ) - rate ) > 0.01 * rate;
+
+	//No index listing every frame (MKV cues, TS): constant rate mapping, a scan of the file would block opening;
+	if ( !bVariable || !m_timecodes.loadIndex( m_pStreamCtx, duration ) )
+		return;
+
+	double frameDuration = m_timecodes.getFrameDuration() * av_q2d( m_pStreamCtx->time_base );
+	if ( frameDuration <= 0 )
+	{
+		m_timecodes.clear();
+		return;
+	}
+
+	m_frameRate = av_d2q( 1.0 / frameDuration, 1001000 );
+	m_streamInfo.mSampleCount = m_timecodes.size();
+}
+
+void VDFFVideoSource::updateAccess( sint64 pos )
+{
+	//Preroll doesn't tell anything about user actions;
+	if ( m_prerollSamples.find( pos ) != m_prerollSamples.end() )
+		return;
+
+	DWORD tick = GetTickCount();
+	bool bIdle = ( tick - m_tickLastRead ) > DRAFT_IDLE_TIME;
+
+	//Scrubbing jumps around, settled position is read again;
+	m_bScrubbing = !bIdle && pos != m_posLastRead + 1 && pos != m_posLastRead;
+
+	m_posLastRead = pos;
+	m_tickLastRead = tick;
+
+	bool bDraft = m_bDraftDecode && m_bScrubbing;
+
+	if ( bDraft == m_bDraftActive )
+		return;
+
+	m_bDraftActive = bDraft;
+
+	VDFFAutoLock lock( getSource() );
+
+	if ( bDraft )
+	{
+		m_pCodecCtx->skip_loop_filter = AVDISCARD_ALL;
+		m_pCodecCtx->skip_idct = AVDISCARD_NONREF;
+		m_pCodecCtx->flags2 |= CODEC_FLAG2_FAST;
+	}
+	else
+	{
+		m_pCodecCtx->skip_loop_filter = AVDISCARD_DEFAULT;
+		m_pCodecCtx->skip_idct = AVDISCARD_DEFAULT;
+		m_pCodecCtx->flags2 &= ~CODEC_FLAG2_FAST;
+
+		//Draft references must not feed full quality frames;
+		if ( !m_bIntraOnly && !m_bKeyframesOnly )
+			m_bDraftFlush = true;
+	}
+}
+
+void VDFFVideoSource::invalidateBuffer( void )
+{
+	VDFFStreamBase::invalidateBuffer(  );
+	//Decode sequence breaked;
+	if ( !m_bIntraOnly )
+		avcodec_flush_buffers( m_pCodecCtx );
+	m_reorder.clear();
+	m_posNext = -1;
+	m_posCurrent = m_streamInfo.mSampleCount;
+	m_bStreamSeeked = true;
+}
+
+void VDFFVideoSource::notifySeek( int64 timestamp )
+{
+	m_posNext = ts2pos( timestamp ) + 1;
+	AVPacket *pPacket = queryPacket();
+	//Keyframe is shown at pts, dts runs ahead by decoder delay;
+	sint64 pts = ( pPacket && pPacket->pts != AV_NOPTS_VALUE ) ? pPacket->pts : getPts( pPacket );
+	if ( pPacket && pts != AV_NOPTS_VALUE )
+	{
+		m_posCurrent = ts2pos( pts );
+	}
+	else
+	{
+		m_posCurrent = ts2pos( timestamp ) - 1;
+	}
+	
+}
+
+
+bool	VDFFVideoSource::decodeFramePacket(  AVFrame* pFrame, AVPacket* pPacket )
+{
+	int gotFrame = 0;
+	AVPacket packet = *pPacket;
+
+	for(;;)
+	{
+		int len = avcodec_decode_video2( m_pCodecCtx, pFrame, &gotFrame, &packet );
+		if ( len >= 0 && len < packet.size )
+		{
+			packet.data += len;
+			packet.size -= len;
+		}
+		else break;
+	}
+	return (gotFrame > 0);
+}
+
+//Planes of VirtualDub planar YUV, returns matching decoder format;
+static PixelFormat VDFFPlanarLayout( int format, int w, int h, int& wChroma, int& hChroma )
+{
+	PixelFormat pixFmt = PIX_FMT_YUV420P;
+	int shiftX = 1;
+	int shiftY = 1;
+
+	switch ( format )
+	{
+	case nsVDXPixmap::kPixFormat_YUV444_Planar:
+		pixFmt = PIX_FMT_YUV444P;	shiftX = 0;	shiftY = 0;
+		break;
+	case nsVDXPixmap::kPixFormat_YUV422_Planar:
+		pixFmt = PIX_FMT_YUV422P;	shiftX = 1;	shiftY = 0;
+		break;
+	case nsVDXPixmap::kPixFormat_YUV411_Planar:
+		pixFmt = PIX_FMT_YUV411P;	shiftX = 2;	shiftY = 0;
+		break;
+	case nsVDXPixmap::kPixFormat_YUV410_Planar:
+		pixFmt = PIX_FMT_YUV410P;	shiftX = 2;	shiftY = 2;
+		break;
+	}
+
+	wChroma = -((-w) >> shiftX);
+	hChroma = -((-h) >> shiftY);
+
+	return pixFmt;
+}
+
+//8-bit format of same planes for little-endian high bit depth YUV or gray, PIX_FMT_NONE otherwise;
+static PixelFormat VDFFReducedFormat( PixelFormat fmt, int& bits )
+{
+	switch ( fmt )
+	{
+	case PIX_FMT_YUV420P9LE:	bits = 9;	return PIX_FMT_YUV420P;
+	case PIX_FMT_YUV420P10LE:	bits = 10;	return PIX_FMT_YUV420P;
+	case PIX_FMT_YUV420P16LE:	bits = 16;	return PIX_FMT_YUV420P;
+	case PIX_FMT_YUV422P9LE:	bits = 9;	return PIX_FMT_YUV422P;
+	case PIX_FMT_YUV422P10LE:	bits = 10;	return PIX_FMT_YUV422P;
+	case PIX_FMT_YUV422P16LE:	bits = 16;	return PIX_FMT_YUV422P;
+	case PIX_FMT_YUV444P9LE:	bits = 9;	return PIX_FMT_YUV444P;
+	case PIX_FMT_YUV444P10LE:	bits = 10;	return PIX_FMT_YUV444P;
+	case PIX_FMT_YUV444P16LE:	bits = 16;	return PIX_FMT_YUV444P;
+	case PIX_FMT_GRAY16LE:		bits = 16;	return PIX_FMT_GRAY8;
+	}
+
+	bits = 8;
+	return PIX_FMT_NONE;
+}
+
+//Dithered reduction of first planes of high bit depth picture;
+static void VDFFReducePicture( const AVPicture* pSrc, PixelFormat reducedFmt, int bits, int w, int h,
+	int planes, uint8_t* const dstData[4], const int dstStride[4] )
+{
+	int shiftX, shiftY;
+	avcodec_get_chroma_sub_sample( reducedFmt, &shiftX, &shiftY );
+
+	if ( reducedFmt == PIX_FMT_GRAY8 )
+		planes = 1;
+
+	for ( int i = 0; i < planes; ++i )
+	{
+		int wPlane = i ? -((-w) >> shiftX) : w;
+		int hPlane = i ? -((-h) >> shiftY) : h;
+
+		VDFFReducePlane( pSrc->data[i], pSrc->linesize[i], bits, wPlane, hPlane, dstData[i], dstStride[i] );
+	}
+}
+
+//Experimental
+uint32 VDFFVideoSource::prepareFrameBuffer( AVPicture* p, int format, void* pFrameBuffer )
+{
+	if ( p ==NULL || p->data[0] == NULL )
+		return 0;
+
+	if ( pFrameBuffer == NULL || m_pFrameBase == NULL )
+		return m_frameSize;
+
+	//Planes as laid out by SetTargetFormat, placed at given buffer;
+	uint8* pBase = (uint8*)pFrameBuffer;
+
+	AVPicture* pPicture = p;
+
+	uint8_t* dstData[4] = { pBase + m_planeOffset[0], NULL, NULL, NULL };
+	int		dstStride[4] = { m_planeStride[0], m_planeStride[1], m_planeStride[2], 0 };
+	if ( m_planeStride[1] )
+	{
+		dstData[1] = pBase + m_planeOffset[1];
+		dstData[2] = pBase + m_planeOffset[2];
+	}
+
+	PixelFormat srcFmt = m_pCodecCtx->pix_fmt;
+
+	//High bit depth without scaling is reduced by own kernels, 8-bit picture takes usual path;
+	int bits;
+	PixelFormat reducedFmt = VDFFReducedFormat( srcFmt, bits );
+	if ( reducedFmt != PIX_FMT_NONE && !m_bDecimate &&
+		m_pixmap.w == m_pCodecCtx->width && m_pixmap.h == m_pCodecCtx->height )
+	{
+		int wChroma, hChroma;
+
+		//Same planes go straight to pixmap;
+		if ( format == nsVDXPixmap::kPixFormat_Y8 )
+		{
+			VDFFReducePicture( pPicture, reducedFmt, bits, m_pixmap.w, m_pixmap.h, 1, dstData, dstStride );
+			return m_frameSize;
+		}
+
+		if ( m_pixmap.data2 && VDFFPlanarLayout( format, m_pixmap.w, m_pixmap.h, wChroma, hChroma ) == reducedFmt )
+		{
+			VDFFReducePicture( pPicture, reducedFmt, bits, m_pixmap.w, m_pixmap.h, 3, dstData, dstStride );
+			return m_frameSize;
+		}
+
+		m_reducedBuffer.resize( avpicture_get_size( reducedFmt, m_pixmap.w, m_pixmap.h ) );
+		avpicture_fill( &m_reducedPicture, &m_reducedBuffer[0], reducedFmt, m_pixmap.w, m_pixmap.h );
+
+		VDFFReducePicture( pPicture, reducedFmt, bits, m_pixmap.w, m_pixmap.h, 3,
+			m_reducedPicture.data, m_reducedPicture.linesize );
+
+		pPicture = &m_reducedPicture;
+		srcFmt = reducedFmt;
+	}
+
+	switch(format) {
+	case nsVDXPixmap::kPixFormat_YUV444_Planar:
+	case nsVDXPixmap::kPixFormat_YUV422_Planar:
+	case nsVDXPixmap::kPixFormat_YUV420_Planar:
+	case nsVDXPixmap::kPixFormat_YUV411_Planar:
+	case nsVDXPixmap::kPixFormat_YUV410_Planar:
+		{
+			int wChroma, hChroma;
+			PixelFormat pixFmt = VDFFPlanarLayout( format, m_pixmap.w, m_pixmap.h, wChroma, hChroma );
+
+			scaleFrame( pPicture, srcFmt, pixFmt, scaleFlags(), dstData, dstStride );
+		}
+		break;
+
+	case nsVDXPixmap::kPixFormat_Y8:
+		//Chroma goes to scratch planes;
+		scaleFrame( pPicture, srcFmt, PIX_FMT_YUV420P, scaleFlags(), dstData, dstStride );
+		break;
+
+	case nsVDXPixmap::kPixFormat_YUV422_UYVY:
+		scaleFrame( pPicture, srcFmt, PIX_FMT_UYVY422, scaleFlags(), dstData, dstStride );
+		break;
+
+	case nsVDXPixmap::kPixFormat_YUV422_YUYV:
+		scaleFrame( pPicture, srcFmt, PIX_FMT_YUYV422, scaleFlags(), dstData, dstStride );
+		break;
+
+	case nsVDXPixmap::kPixFormat_XRGB1555:
+		scaleFrame( pPicture, srcFmt, PIX_FMT_RGB555, scaleFlags(), dstData, dstStride );
+		break;
+
+	case nsVDXPixmap::kPixFormat_RGB565:
+		scaleFrame( pPicture, srcFmt, PIX_FMT_RGB565, scaleFlags(), dstData, dstStride );
+		break;
+
+	case nsVDXPixmap::kPixFormat_RGB888:
+		if ( convertUnscaledRGB( pPicture, srcFmt, dstData[0], dstStride[0], 3 ) ) break;
+
+		scaleFrame( pPicture, srcFmt, PIX_FMT_BGR24, scaleFlags(), dstData, dstStride );
+		break;
+
+	case nsVDXPixmap::kPixFormat_XRGB8888:
+		if ( convertUnscaledRGB( pPicture, srcFmt, dstData[0], dstStride[0], 4 ) ) break;
+
+		scaleFrame( pPicture, srcFmt, PIX_FMT_BGRA, scaleFlags(), dstData, dstStride );
+		break;
+
+	default:
+		return 0;
+	}
+
+	return m_frameSize;
+}
+
+bool VDFFVideoSource::convertUnscaledRGB( AVPicture* pPicture, PixelFormat srcFmt, uint8_t* pDst, int pitchDst, int bytesPerPixel )
+{
+	if ( m_pCodecCtx->width != m_pixmap.w || m_pCodecCtx->height != m_pixmap.h )
+		return false;
+
+	int layout = kVDFFLayout_YUV420P;
+	bool bFullRange = ( m_pCodecCtx->color_range == AVCOL_RANGE_JPEG );
+
+	switch ( srcFmt )
+	{
+	case PIX_FMT_YUV420P:
+		break;
+	case PIX_FMT_YUVJ420P:
+		bFullRange = true;
+		break;
+	case PIX_FMT_NV12:
+		layout = kVDFFLayout_NV12;
+		break;
+	default:
+		return false;
+	}
+
+	VDFFYUVPlanes planes;
+	planes.pY		= pPicture->data[0];
+	planes.pU		= pPicture->data[1];
+	planes.pV		= pPicture->data[2];
+	planes.pitchY	= pPicture->linesize[0];
+	planes.pitchUV	= pPicture->linesize[1];
+
+	int matrix = ( m_pCodecCtx->colorspace == AVCOL_SPC_BT709 ) ? kVDFFMatrix_BT709 : kVDFFMatrix_BT601;
+
+	return VDFFConvertYUVToRGB( planes, layout, matrix, bFullRange,
+		m_pixmap.w, m_pixmap.h, pDst, pitchDst, bytesPerPixel );
+}
+
+int VDFFVideoSource::scaleFlags( void ) const
+{
+	if ( m_bDecimate )
+		return SWS_FAST_BILINEAR;
+
+	//Only frames passed by while scrubbing are previews, playback and export frames are final;
+	return m_bScrubbing ? m_previewScaleFlags : m_exportScaleFlags;
+}
+
+int VDFFVideoSource::convertFlags( void ) const
+{
+	return isPassthrough( m_pixmap.format ) ? 0 : scaleFlags();
+}
+
+bool VDFFVideoSource::isBufferCurrent( void ) const
+{
+	return m_fmtBuffer == m_pixmap.format && m_bDraftBuffer == m_bDraftActive && m_flagsBuffer == convertFlags();
+}
+
+void VDFFVideoSource::scaleFrame( AVPicture* pPicture, PixelFormat srcFmt, PixelFormat dstFmt, int flags, uint8_t* dstData[4], int dstStride[4] )
+{
+	VDFFScaleParams params;
+	params.wSrc			= m_pCodecCtx->width;
+	params.hSrc			= m_pCodecCtx->height;
+	params.srcFmt		= srcFmt;
+	params.wDst			= m_pixmap.w;
+	params.hDst			= m_pixmap.h;
+	params.dstFmt		= dstFmt;
+	params.flags		= flags;
+	params.colorspace	= m_pCodecCtx->colorspace;
+	params.srcRange		= ( m_pCodecCtx->color_range == AVCOL_RANGE_JPEG ) ? 1 : 0;
+
+	//Bands need rows mapped one to one;
+	if ( m_converter.convert( pPicture, params, dstData, dstStride ) )
+		return;
+
+	SwsContext* pSwsCtx = m_scalers.get( params );
+	if ( !pSwsCtx )
+		return;
+
+	sws_scale( pSwsCtx, pPicture->data, pPicture->linesize, 0,
+		m_pCodecCtx->height, dstData, dstStride);
+}
+
+void VDXAPIENTRY VDFFVideoSource::GetStreamSourceInfo(VDXStreamSourceInfo& srcInfo)
+{
+	srcInfo = m_streamInfo;
+}
+
+bool VDFFVideoSource::Read(sint64 lStart64, uint32 lCount, void *lpBuffer, uint32 cbBuffer, uint32 *lBytesRead, uint32 *lSamplesRead) 
+{
+	//One sample per call whatever lCount is: host hands DecodeFrame the buffer of a single sample;
+
+	//Size query is followed by real read of same sample, only real reads tell access pattern;
+	if ( lpBuffer )
+		updateAccess( lStart64 );
+
+	//One byte - marked packet for not copying buffer;
+	//preroll samples are decoded by Read of target, never converted by DecodeFrame;
+	std::set<sint64>::iterator itPreroll = m_prerollSamples.find( lStart64 );
+	bool bPreroll = itPreroll != m_prerollSamples.end();
+
+	bool bSequential = ( lStart64 == m_posAheadLast + 1 );
+	if ( lpBuffer )
+		m_posAheadLast = lStart64;
+
+	if ( lpBuffer && !bPreroll && lStart64 != m_posLastTarget )
+	{
+		if ( lStart64 == m_posLastTarget + 1 )
+			++m_nSequentialTargets;
+		else
+			m_nSequentialTargets = 0;
+		m_posLastTarget = lStart64;
+	}
+
+	//Nothing to decode yet, decodeToSample of target runs whole chain and skips non-reference frames;
+	if ( bPreroll )
+	{
+		if ( lpBuffer && cbBuffer < 1 ) {
+			if (lSamplesRead) *lSamplesRead = 0;
+			if (lBytesRead) *lBytesRead = 0;
+			return false;
+		}
+
+		if (lSamplesRead) *lSamplesRead = 1;
+		if (lBytesRead) *lBytesRead = 1;
+		if ( lpBuffer )
+		{
+			*(uint8*)lpBuffer = 0;
+			m_prerollSamples.erase( itPreroll );
+		}
+		return true;
+	}
+
+	//Repeated or recently shown picture is converted already, nothing to decode;
+	EnterCriticalSection( &m_csOutput );
+	bool bDone = isConverted( lStart64, lpBuffer != NULL ) || ( m_duplicates.isDuplicate( lStart64 ) &&
+		m_duplicates.getOrigin( lStart64 ) == m_posDecode && isBufferCurrent() );
+	LeaveCriticalSection( &m_csOutput );
+
+	if ( bDone )
+	{
+		if ( lpBuffer && cbBuffer < 1 ) {
+			if (lSamplesRead) *lSamplesRead = 0;
+			if (lBytesRead) *lBytesRead = 0;
+			return false;
+		}
+
+		if (lSamplesRead) *lSamplesRead = 1;
+		if (lBytesRead) *lBytesRead = 1;
+		if ( lpBuffer )
+			*(uint8*)lpBuffer = 0;
+		return true;
+	}
+
+	const std::vector<uint8>* pBuffer = NULL;
+
+	if ( m_pParallel && m_pParallel->isActive() )
+	{
+		if ( lStart64 == m_posParallel || m_pParallel->getFrame( lStart64, m_parallelBuffer ) )
+		{
+			m_posParallel = lStart64;
+			pBuffer = &m_parallelBuffer;
+		}
+		else
+		{
+			m_pParallel->stop();
+			m_posParallel = -1;
+		}
+	}
+
+	bool bParallel = ( pBuffer != NULL );
+
+	AheadFrame* pAheadFrame = NULL;
+	if ( !bParallel )
+	{
+		EnterCriticalSection( &m_csAhead );
+		pAheadFrame = queryAheadFrame( lStart64 );
+		if ( pAheadFrame )
+			pBuffer = &pAheadFrame->data;
+	}
+
+	bool bAhead = ( pAheadFrame != NULL );
+	//Converted frame stays out of read buffer, DecodeFrame takes it by sample;
+	bool bConverted = bAhead && pAheadFrame->bConverted;
+
+	PoolCursor* pCursor = NULL;
+
+	if ( !bParallel && !bAhead )
+	{
+		LeaveCriticalSection( &m_csAhead );
+
+		pCursor = pickCursor( lStart64 );
+		if ( pCursor && decodeCursorSample( pCursor, lStart64 ) )
+		{
+			pBuffer = &pCursor->current.data;
+		}
+		else
+		{
+			pCursor = NULL;
+
+			getSource()->lock();
+			if ( !decodeToSample( lStart64 ) )
+			{
+				getSource()->unlock();
+				return false;
+			}
+			pBuffer = &m_currentBuffer;
+		}
+	}
+
+	//Converted frame carries hash of decoded picture;
+	if ( bConverted )
+		m_duplicates.confirmHash( lStart64, pAheadFrame->hash );
+	else
+		m_duplicates.confirm( lStart64, *pBuffer );
+
+	uint32 size = bConverted ? 1 : (uint32)pBuffer->size();
+	bool bResult = true;
+	
+	if (!lpBuffer) {
+		if (lSamplesRead) *lSamplesRead = 1;
+		if (lBytesRead) *lBytesRead = size;
+	}
+	else if ( size > cbBuffer) {
+		if (lSamplesRead) *lSamplesRead = 0;
+		if (lBytesRead) *lBytesRead = 0;
+		bResult = false;
+	}
+	else
+	{
+		if (lSamplesRead) *lSamplesRead = 1;
+		if (lBytesRead) *lBytesRead = size;
+
+		if ( bConverted )
+		{
+			*(uint8*)lpBuffer = 0;
+
+			//Hand slot over, ring gets spare buffer instead;
+			std::vector<uint8> data;
+			data.swap( pAheadFrame->data );
+			m_convertedFrames.push_back( *pAheadFrame );
+			m_convertedFrames.back().data.swap( data );
+			if ( !m_spareBuffers.empty() )
+			{
+				pAheadFrame->data.swap( m_spareBuffers.back() );
+				m_spareBuffers.pop_back();
+			}
+
+			//Samples never decoded by host;
+			if ( m_convertedFrames.size() > MAX_DECODE_AHEAD )
+			{
+				m_spareBuffers.push_back( std::vector<uint8>() );
+				m_spareBuffers.back().swap( m_convertedFrames.front().data );
+				m_convertedFrames.pop_front();
+			}
+		}
+		else
+			memcpy( lpBuffer, &(*pBuffer)[0], pBuffer->size() );
+
+		if ( bAhead )
+			popAheadFrame();
+	}
+
+	if ( bAhead )
+	{
+		LeaveCriticalSection( &m_csAhead );
+	}
+	else if ( !bParallel && !pCursor )
+	{
+		getSource()->unlock();
+
+		//Sequential access keeps following frames ready, seek outside scrubbing restarts there;
+		bool bStarted = bSequential && lpBuffer && startParallel( lStart64 + 1 );
+		if ( lpBuffer && !bStarted && ( bSequential || !m_bScrubbing ) && m_hAheadThread )
+		{
+			EnterCriticalSection( &m_csAhead );
+			m_posAhead = lStart64 + 1;
+			m_bAheadActive = true;
+			SetEvent( m_hAheadWake );
+			LeaveCriticalSection( &m_csAhead );
+		}
+	}
+	
+	return bResult;
+}
+
+bool VDFFVideoSource::detectIntraOnly( void ) const
+{
+	switch ( m_pCodecCtx->codec_id )
+	{
+	case CODEC_ID_MJPEG:
+	case CODEC_ID_MJPEGB:
+	case CODEC_ID_LJPEG:
+	case CODEC_ID_JPEGLS:
+	case CODEC_ID_JPEG2000:
+	case CODEC_ID_DVVIDEO:
+	case CODEC_ID_PRORES:
+	case CODEC_ID_DNXHD:
+	case CODEC_ID_HUFFYUV:
+	case CODEC_ID_FFVHUFF:
+	case CODEC_ID_RAWVIDEO:
+	case CODEC_ID_V210:
+	case CODEC_ID_PNG:
+	case CODEC_ID_BMP:
+	case CODEC_ID_TARGA:
+	case CODEC_ID_SGI:
+		return true;
+	default:
+		break;
+	}
+
+	//Full index without delta frames (FFV1 intra, etc.);
+	if ( m_pStreamCtx->nb_index_entries * 10 < m_streamInfo.mSampleCount * 9 )
+		return false;
+
+	for ( int i = 0; i < m_pStreamCtx->nb_index_entries; ++i )
+	{
+		if ( !(m_pStreamCtx->index_entries[i].flags & AVINDEX_KEYFRAME) )
+			return false;
+	}
+
+	return m_pStreamCtx->nb_index_entries > 0;
+}
+
+bool VDFFVideoSource::decodeToSample( sint64 lStart64 )
+{
+	AVFrame *pFrame = &m_avframe;
+
+	if ( m_bIntraOnly )
+		return decodeIntraSample( lStart64 );
+
+	if ( m_bKeyframesOnly )
+	{
+		//Jump straight from keyframe to keyframe;
+		lStart64 = getKeyFrame( lStart64 );
+		if ( lStart64 != m_posCurrent )
+		{
+			if ( !seekPacket( pos2ts( lStart64 ) ) )
+				return false;
+		}
+	}
+	else if ( m_bDraftFlush )
+	{
+		//Decode again from keyframe with full quality;
+		if ( !seekPacket( pos2ts( lStart64 ) ) )
+			return false;
+		m_bDraftFlush = false;
+	}
+	else if ( isSeekCheaper( lStart64 ) )
+	{
+		double start = VDFFTicks();
+		if ( !seekPacket( pos2ts( lStart64 ) ) )
+			return false;
+		updateCost( m_seekTime, VDFFTicks() - start );
+	}
+
+	AVPacket* pPacket = NULL;
+
+	bool bGotFrame = false;
+	bool bSkipToKey = m_bStreamSeeked;
+
+	while ( lStart64 >= m_posNext || m_bStreamSeeked )
+	{
+		if ( pPacket ) popPacket();
+
+		pPacket = queryPacket();
+
+		if ( pPacket == NULL ) break;
+
+		//Check if stream seek before key;
+	//	if ( bSkipToKey && pPacket->flags != AV_PKT_FLAG_KEY ) continue;
+		bSkipToKey = false;
+
+		//Frames nobody refers to are never shown before target, don't decode them while prerolling;
+		if ( !m_bKeyframesOnly )
+		{
+			sint64 posPacket = ( pPacket->pts != AV_NOPTS_VALUE ) ? ts2pos( pPacket->pts ) : lStart64;
+			bool bPreroll = posPacket + m_pCodecCtx->has_b_frames + 1 < lStart64;
+			m_pCodecCtx->skip_frame = bPreroll ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+		}
+
+		avcodec_get_frame_defaults( pFrame );
+
+		m_reorder.push( pPacket, m_pCodecCtx->has_b_frames );
+
+		double start = VDFFTicks();
+		bool bDecoded = decodeFramePacket( pFrame, pPacket );
+		updateCost( m_decodeTime, VDFFTicks() - start );
+
+		if ( bDecoded )
+		{	
+			bGotFrame = true;
+			m_posCurrent = m_posNext;
+
+			/*uint32 size = prepareFrameBuffer( pFrame, m_pixmap.format, NULL );
+			if ( !m_bStreamSeeked )
+				m_currentBuffer = m_nextBuffer;
+			m_nextBuffer.resize( size );
+			prepareFrameBuffer( pFrame, m_pixmap.format, &m_nextBuffer[0] );*/
+
+			uint32 size = avpicture_get_size( m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height );
+			if ( !m_bStreamSeeked )
+				m_currentBuffer = m_nextBuffer;
+			m_nextBuffer.resize( size );
+			avpicture_layout( (AVPicture*)pFrame, m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height,
+				&m_nextBuffer[0], (int)m_nextBuffer.size());
+						
+			if ( m_bStreamSeeked )
+			{
+				m_posCurrent = lStart64;
+				m_bStreamSeeked = false;
+				m_currentBuffer = m_nextBuffer;
+			}
+			//Position of frame in presentation order;
+			int64 pts = m_reorder.pop( pFrame );
+			if ( pts != AV_NOPTS_VALUE )
+				m_posNext = ts2pos( pts );
+			else m_posNext += 1;
+
+			//Nothing to decode between keyframes;
+			if ( m_bKeyframesOnly )
+				break;
+		}
+		
+	}
+
+	if ( !m_bKeyframesOnly )
+		m_pCodecCtx->skip_frame = AVDISCARD_DEFAULT;
+
+	if ( m_pFormatCtx->pb->eof_reached )
+		m_posNext = m_streamInfo.mSampleCount;
+
+	m_bStreamSeeked = false;
+
+	if ( pPacket ) popPacket();
+
+	return true;
+}
+
+bool VDFFVideoSource::decodeIntraSample( sint64 sample )
+{
+	if ( sample == m_posCurrent && !m_bStreamSeeked )
+		return true;
+
+	AVPacket* pPacket = queryPacket();
+	sint64 pts = pPacket ? getPts( pPacket ) : AV_NOPTS_VALUE;
+	sint64 posPacket = ( pts != AV_NOPTS_VALUE ) ? ts2pos( pts ) : -1;
+
+	//Packets short way ahead are skipped, no need to seek;
+	if ( posPacket < 0 || posPacket > sample || posPacket + m_posDelta < sample )
+	{
+		if ( !seekPacket( pos2ts( sample ) ) )
+			return false;
+		pPacket = queryPacket();
+	}
+
+	AVFrame *pFrame = &m_avframe;
+	bool bGotFrame = false;
+	sint64 posFrame = -1;
+
+	while ( !bGotFrame && pPacket )
+	{
+		pts = getPts( pPacket );
+		posPacket = ( pts != AV_NOPTS_VALUE ) ? ts2pos( pts ) : sample;
+
+		if ( posPacket >= sample )
+		{
+			avcodec_get_frame_defaults( pFrame );
+
+			if ( decodeFramePacket( pFrame, pPacket ) )
+			{
+				//Picture tells its own time, packet of sample may be missing;
+				posFrame = ( pFrame->best_effort_timestamp != AV_NOPTS_VALUE ) ?
+					ts2pos( pFrame->best_effort_timestamp ) : posPacket;
+				bGotFrame = posFrame >= sample;
+			}
+		}
+
+		popPacket();
+		m_posNext = posPacket + 1;
+
+		if ( !bGotFrame )
+			pPacket = queryPacket();
+	}
+
+	m_bStreamSeeked = false;
+
+	//End of stream or broken packets, nothing shown for sample;
+	if ( !bGotFrame )
+		return false;
+
+	uint32 size = avpicture_get_size( m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height );
+	m_currentBuffer.resize( size );
+	avpicture_layout( (AVPicture*)pFrame, m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height,
+		&m_currentBuffer[0], (int)m_currentBuffer.size());
+
+	//Later picture is kept under its own position, not under requested one;
+	m_posCurrent = posFrame;
+
+	return posFrame == sample;
+}
+
+sint64 VDFFVideoSource::seekDecodeCost( sint64 sample )
+{
+	//Without index seek lands on unknown keyframe;
+	if ( !m_bIntraOnly && m_pStreamCtx->nb_index_entries == 0 )
+		return m_posDelta;
+
+	sint64 seekFrames = DECODER_SEEK_COST;
+	if ( m_decodeTime > 0 && m_seekTime > 0 )
+		seekFrames = (sint64)( m_seekTime / m_decodeTime + 0.5 );
+
+	return seekFrames + sample - getKeyFrame( sample ) + 1;
+}
+
+bool VDFFVideoSource::isSeekCheaper( sint64 sample )
+{
+	//Backward, buffered or after stream seek (first read, seek by other stream) as before;
+	if ( m_bStreamSeeked || sample < m_posNext )
+		return sample > m_posNext + m_posDelta || sample < m_posCurrent;
+
+	//Forward gap, decoding on may cost less than seek;
+	return sample - m_posNext + 1 > seekDecodeCost( sample );
+}
+
+sint64 VDFFVideoSource::sourceDecodeCost( sint64 sample )
+{
+	VDFFAutoLock lock( getSource() );
+
+	//Same rule as decodeToSample;
+	if ( isSeekCheaper( sample ) )
+		return seekDecodeCost( sample );
+
+	return FFMAX( sample - m_posNext + 1, 0 );
+}
+
+VDFFVideoSource::PoolCursor* VDFFVideoSource::pickCursor( sint64 sample )
+{
+	if ( !m_bDecoderPool || m_nSequentialTargets >= POOL_SEQUENTIAL_FRAMES )
+	{
+		m_sourceLastUsed = ++m_poolCounter;
+		return NULL;
+	}
+
+	sint64 seekCost = seekDecodeCost( sample );
+	sint64 bestCost = sourceDecodeCost( sample );
+	PoolCursor* pBest = NULL;
+
+	for ( size_t i = 0; i < m_cursorPool.size(); ++i )
+	{
+		PoolCursor* pCursor = m_cursorPool[i];
+		if ( pCursor->current.pos < 0 || pCursor->current.pos > sample )
+			continue;
+
+		sint64 cost = sample - pCursor->current.pos;
+		if ( cost < bestCost )
+		{
+			bestCost = cost;
+			pBest = pCursor;
+		}
+	}
+
+	//Every decoder has to seek, take new or least recently used one;
+	if ( bestCost >= seekCost )
+	{
+		pBest = NULL;
+		uint32 lastUsed = m_sourceLastUsed;
+
+		if ( m_cursorPool.size() < DECODER_POOL_SIZE )
+		{
+			AVFormatContext* pFormatCtx = getSource()->getContext();
+			PoolCursor* pCursor = new PoolCursor;
+			pCursor->current.pos = -1;
+			pCursor->pending.pos = -1;
+			pCursor->lastUsed = 0;
+			pCursor->bDraft = false;
+
+			if ( pCursor->cursor.open( pFormatCtx->filename, getIndex(), m_pCodecCtx->lowres ) )
+			{
+				m_cursorPool.push_back( pCursor );
+				pBest = pCursor;
+			}
+			else
+			{
+				delete pCursor;
+				m_bDecoderPool = 0;
+			}
+		}
+
+		for ( size_t i = 0; !pBest && i < m_cursorPool.size(); ++i )
+		{
+			if ( m_cursorPool[i]->lastUsed < lastUsed )
+				lastUsed = m_cursorPool[i]->lastUsed;
+		}
+
+		for ( size_t i = 0; !pBest && i < m_cursorPool.size(); ++i )
+		{
+			if ( m_cursorPool[i]->lastUsed == lastUsed )
+				pBest = m_cursorPool[i];
+		}
+	}
+
+	if ( pBest )
+		pBest->lastUsed = ++m_poolCounter;
+	else
+		m_sourceLastUsed = ++m_poolCounter;
+
+	return pBest;
+}
+
+bool VDFFVideoSource::decodeCursorSample( PoolCursor* pCursor, sint64 sample )
+{
+	VDFFRawFrame& current = pCursor->current;
+	VDFFRawFrame& pending = pCursor->pending;
+
+	//Draft references must not feed full quality frames;
+	if ( pCursor->bDraft && !m_bDraftActive )
+	{
+		current.pos = -1;
+		pending.pos = -1;
+	}
+
+	if ( current.pos == sample )
+		return true;
+
+	bool bForward = current.pos >= 0 && current.pos <= sample &&
+		sample - current.pos < seekDecodeCost( sample );
+
+	pCursor->cursor.setQuality( m_bDraftActive, m_bKeyframesOnly != 0 );
+	pCursor->bDraft = m_bDraftActive;
+
+	sint64 posPreroll = sample - m_pCodecCtx->has_b_frames - 1;
+	int64 tsPreroll = ( posPreroll > 0 ) ? pos2ts( posPreroll ) : AV_NOPTS_VALUE;
+
+	if ( !bForward )
+	{
+		if ( !pCursor->cursor.seek( pos2ts( getKeyFrame( sample ) ) ) )
+			return false;
+
+		current.pos = -1;
+		pending.pos = -1;
+	}
+
+	for (;;)
+	{
+		if ( pending.pos >= 0 )
+		{
+			if ( pending.pos > sample && current.pos >= 0 )
+				break;
+
+			current.pos = pending.pos;
+			current.data.swap( pending.data );
+			pending.pos = -1;
+
+			if ( current.pos >= sample )
+				break;
+		}
+
+		int64 timestamp;
+		if ( !pCursor->cursor.decodeNext( pending.data, timestamp, tsPreroll ) )
+			break;
+
+		pending.pos = ( timestamp != AV_NOPTS_VALUE ) ? ts2pos( timestamp ) : current.pos + 1;
+	}
+
+	//Cursor decoder doesn't match source;
+	if ( current.pos < 0 || current.data.size() != m_currentBuffer.size() )
+	{
+		current.pos = -1;
+		pending.pos = -1;
+		return false;
+	}
 
-		m_pSwsCtx = sws_getCachedContext(m_pSwsCtx, wSrc, hSrc,
-			m_pCodecCtx->pix_fmt,
-			wDst, hDst, PIX_FMT_YUYV422, SWS_FAST_BILINEAR,
-			NULL, NULL, NULL);
+	return true;
+}
 
-		sws_scale( m_pSwsCtx, pPicture->data, pPicture->linesize, 0,
-			m_pCodecCtx->height, dstData, dstStride);
+bool VDFFVideoSource::startParallel( sint64 sample )
+{
+	if ( !m_bParallelDecode )
+		return false;
 
-		break;
-	case nsVDXPixmap::kPixFormat_XRGB1555:
-		dstData[0] = pBuffer + wDst*2*(hDst-1);					dstStride[0] = -wDst*2;
+	if ( !m_pParallel )
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo( &info );
 
-		size = wDst*2*hDst;
-		if ( pBuffer == NULL ) break;
+		int workers = FFMIN( (int)info.dwNumberOfProcessors, MAX_PARALLEL_DECODERS );
+		if ( workers < 2 )
+		{
+			m_bParallelDecode = 0;
+			return false;
+		}
 
-		m_pSwsCtx = sws_getCachedContext(m_pSwsCtx, wSrc, hSrc,
-			m_pCodecCtx->pix_fmt,
-			wDst, hDst, PIX_FMT_RGB555, SWS_BICUBIC,
-			NULL, NULL, NULL);
+		m_pParallel = new VDFFParallelDecoder( this, workers, (uint32)m_currentBuffer.size(), m_streamInfo.mSampleCount );
+	}
 
-		sws_scale( m_pSwsCtx, pPicture->data, pPicture->linesize, 0,
-			m_pCodecCtx->height, dstData, dstStride);
-		break;
-	case nsVDXPixmap::kPixFormat_RGB565:
-		dstData[0] = pBuffer + wDst*2*(hDst-1);	dstStride[0] = -wDst*2;
+	m_posParallel = -1;
+	return m_pParallel->start( sample );
+}
 
-		size = wDst*2*hDst;
-		if ( pBuffer == NULL ) break;
+bool VDFFVideoSource::startDecodeAhead( void )
+{
+	m_hAheadWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+	m_hAheadReady = CreateEvent( NULL, FALSE, FALSE, NULL );
 
-		m_pSwsCtx = sws_getCachedContext(m_pSwsCtx, wSrc, hSrc,
-			m_pCodecCtx->pix_fmt,
-			wDst, hDst, PIX_FMT_RGB565, SWS_BICUBIC,
-			NULL, NULL, NULL);
+	if ( m_hAheadWake && m_hAheadReady )
+		m_hAheadThread = (HANDLE)_beginthreadex( NULL, 0, decodeAheadThread, this, 0, NULL );
 
-		sws_scale( m_pSwsCtx, pPicture->data, pPicture->linesize, 0,
-			m_pCodecCtx->height, dstData, dstStride);
+	if ( m_hAheadThread == NULL )
+	{
+		stopDecodeAhead();
+		return false;
+	}
 
-		break;
-	case nsVDXPixmap::kPixFormat_RGB888:
-		dstData[0] = pBuffer + wDst*3*(hDst-1); dstStride[0] = -wDst*3;
+	return true;
+}
 
-		size = wDst*3*hDst;
-		if ( pBuffer == NULL ) break;
+void VDFFVideoSource::stopDecodeAhead( void )
+{
+	if ( m_hAheadThread )
+	{
+		EnterCriticalSection( &m_csAhead );
+		m_bAheadExit = true;
+		cancelDecodeAhead();
+		SetEvent( m_hAheadWake );
+		LeaveCriticalSection( &m_csAhead );
+
+		WaitForSingleObject( m_hAheadThread, INFINITE );
+		CloseHandle( m_hAheadThread );
+		m_hAheadThread = NULL;
+	}
 
-		m_pSwsCtx = sws_getCachedContext(m_pSwsCtx, wSrc, hSrc,
-			m_pCodecCtx->pix_fmt,
-			wDst, hDst, PIX_FMT_BGR24, SWS_BICUBIC,
-			NULL, NULL, NULL);
+	if ( m_hAheadWake )
+		CloseHandle( m_hAheadWake );
+	if ( m_hAheadReady )
+		CloseHandle( m_hAheadReady );
 
-		sws_scale( m_pSwsCtx, pPicture->data, pPicture->linesize, 0,
-			m_pCodecCtx->height, dstData, dstStride);
+	m_hAheadWake = NULL;
+	m_hAheadReady = NULL;
+}
 
-		break;
-	case nsVDXPixmap::kPixFormat_XRGB8888:
-		dstData[0] = pBuffer + wDst*4*(hDst-1); dstStride[0] = -wDst*4;
+VDFFVideoSource::AheadFrame* VDFFVideoSource::queryAheadFrame( sint64 sample )
+{
+	if ( !m_bAheadActive && m_aheadCount == 0 )
+		return NULL;
 
-		size = wDst*4*hDst;
-		if ( pBuffer == NULL ) break;
+	for (;;)
+	{
+		//Drop frames skipped by reader;
+		while ( m_aheadCount > 0 && m_aheadFrames[m_aheadFirst].pos < sample )
+			popAheadFrame();
 
-		m_pSwsCtx = sws_getCachedContext(m_pSwsCtx, wSrc, hSrc,
-			m_pCodecCtx->pix_fmt,
-			wDst, hDst, PIX_FMT_BGRA, SWS_BICUBIC,
-			NULL, NULL, NULL);
+		if ( m_aheadCount > 0 )
+		{
+			if ( m_aheadFrames[m_aheadFirst].pos == sample )
+				return &m_aheadFrames[m_aheadFirst];
+			break;
+		}
 
-		sws_scale( m_pSwsCtx, pPicture->data, pPicture->linesize, 0,
-			m_pCodecCtx->height, dstData, dstStride);
+		//Wait if thread is about to reach sample, otherwise seek is cheaper;
+		if ( !m_bAheadActive || sample < m_posAhead || sample >= m_posAhead + MAX_DECODE_AHEAD )
+			break;
 
-		break;
+		LeaveCriticalSection( &m_csAhead );
+		WaitForSingleObject( m_hAheadReady, INFINITE );
+		EnterCriticalSection( &m_csAhead );
 	}
 
-	return size;
+	cancelDecodeAhead();
+	return NULL;
 }
 
-void VDXAPIENTRY VDFFVideoSource::GetStreamSourceInfo(VDXStreamSourceInfo& srcInfo)
+void VDFFVideoSource::popAheadFrame( void )
 {
-	srcInfo = m_streamInfo;
+	if ( m_aheadCount == 0 )
+		return;
+
+	m_aheadFirst = ( m_aheadFirst + 1 ) % MAX_DECODE_AHEAD;
+	--m_aheadCount;
+	SetEvent( m_hAheadWake );
 }
 
-bool VDFFVideoSource::Read(sint64 lStart64, uint32 lCount, void *lpBuffer, uint32 cbBuffer, uint32 *lBytesRead, uint32 *lSamplesRead) 
+void VDFFVideoSource::cancelDecodeAhead( void )
 {
-	AVFrame *pFrame = &m_avframe;
-
-	int64 hiTs = this->pos2ts( lStart64 );
-		
-	if ( (lStart64 > m_posNext + m_posDelta || lStart64 < m_posCurrent) )
-	{
-		if ( !seekPacket( pos2ts( lStart64 ) ) )
-			return false;
-	}
+	m_bAheadActive = false;
+	m_aheadCount = 0;
+	++m_aheadGeneration;
+}
 
-	AVPacket* pPacket = NULL;
+unsigned __stdcall VDFFVideoSource::decodeAheadThread( void* pParam )
+{
+	((VDFFVideoSource*)pParam)->decodeAheadLoop();
+	return 0;
+}
 
-	bool bGotFrame = false;
-	bool bSkipToKey = m_bStreamSeeked;
+void VDFFVideoSource::decodeAheadLoop( void )
+{
+	EnterCriticalSection( &m_csAhead );
 
-	while ( lStart64 >= m_posNext || m_bStreamSeeked )
+	for (;;)
 	{
-		if ( pPacket ) popPacket();
-
-		pPacket = queryPacket();
-
-		if ( pPacket == NULL ) break;
-
-		//Check if stream seek before key;
-	//	if ( bSkipToKey && pPacket->flags != AV_PKT_FLAG_KEY ) continue;
-		bSkipToKey = false;
+		while ( !m_bAheadExit && ( !m_bAheadActive || m_aheadCount == MAX_DECODE_AHEAD ) )
+		{
+			LeaveCriticalSection( &m_csAhead );
+			WaitForSingleObject( m_hAheadWake, INFINITE );
+			EnterCriticalSection( &m_csAhead );
+		}
 
-		avcodec_get_frame_defaults( pFrame );
+		if ( m_bAheadExit )
+			break;
 
-		if ( decodeFramePacket( pFrame, pPacket ) )
-		{	
-			bGotFrame = true;
-			m_posCurrent = m_posNext;
+		sint64 pos = m_posAhead;
+		uint32 generation = m_aheadGeneration;
+		//Slot isn't visible to reader until frame is committed;
+		AheadFrame& frame = m_aheadFrames[( m_aheadFirst + m_aheadCount ) % MAX_DECODE_AHEAD];
 
-			/*uint32 size = prepareFrameBuffer( pFrame, m_pixmap.format, NULL );
-			if ( !m_bStreamSeeked )
-				m_currentBuffer = m_nextBuffer;
-			m_nextBuffer.resize( size );
-			prepareFrameBuffer( pFrame, m_pixmap.format, &m_nextBuffer[0] );*/
+		LeaveCriticalSection( &m_csAhead );
 
-			uint32 size = avpicture_get_size( m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height );
-			if ( !m_bStreamSeeked )
-				m_currentBuffer = m_nextBuffer;
-			m_nextBuffer.resize( size );
-			avpicture_layout( (AVPicture*)pFrame, m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height,
-				&m_nextBuffer[0], (int)m_nextBuffer.size());
-						
-			if ( m_bStreamSeeked )
+		bool bDecoded = false;
+		if ( pos < m_streamInfo.mSampleCount )
+		{
+			VDFFAutoLock lock( getSource() );
+			bDecoded = decodeToSample( pos );
+			if ( bDecoded && !convertAheadFrame( frame ) )
 			{
-				m_posCurrent = lStart64;
-				m_bStreamSeeked = false;
-				m_currentBuffer = m_nextBuffer;
+				frame.data = m_currentBuffer;
+				frame.bConverted = false;
 			}
-			//BUG: correct next position if no pts;
-			sint64 pos = m_posNext;
-			if ( pFrame->best_effort_timestamp != AV_NOPTS_VALUE )
-				m_posNext = ts2pos( pFrame->best_effort_timestamp );
-			else m_posNext += 1;
 		}
-		
-	}
-
-	if ( m_pFormatCtx->pb->eof_reached )
-		m_posNext = m_streamInfo.mSampleCount;
 
-	m_bStreamSeeked = false;
+		EnterCriticalSection( &m_csAhead );
 
-	//One byte - marked packet for not copying buffer;
-	if ( pPacket ) popPacket();
-	
-	if (!lpBuffer) {
-		if (lSamplesRead) *lSamplesRead = 1;
-		if (lBytesRead) *lBytesRead = (uint32)m_currentBuffer.size();
-		return true;
-	}
+		if ( generation == m_aheadGeneration )
+		{
+			if ( bDecoded )
+			{
+				frame.pos = pos;
+				++m_aheadCount;
+				++m_posAhead;
+			}
+			else
+				m_bAheadActive = false;
 
-	if ( m_currentBuffer.size() > cbBuffer) {
-		if (lSamplesRead) *lSamplesRead = 0;
-		if (lBytesRead) *lBytesRead = 0;
-		return false;
+			SetEvent( m_hAheadReady );
+		}
 	}
 
-	if (lSamplesRead) *lSamplesRead = 1;
-	if (lBytesRead) *lBytesRead =  (uint32)m_currentBuffer.size();
-
-	memcpy( lpBuffer, &m_currentBuffer[0], m_currentBuffer.size() );
-	
-	return true;
+	LeaveCriticalSection( &m_csAhead );
 }
 
 const void *VDFFVideoSource::GetDirectFormat()
@@ -825,7 +3686,7 @@ sint64 VDFFVideoSource::PositionToTimeVBR(sint64 samples)
 
 void VDFFVideoSource::GetVideoSourceInfo(VDXVideoSourceInfo& info)
 {
-	info.mFlags = 0;
+	info.mFlags = ( m_bKeyframesOnly || m_bIntraOnly ) ? VDXVideoSourceInfo::kFlagKeyframeOnly : 0;
 	info.mWidth = m_pixmap.w;
 	info.mHeight = m_pixmap.h;
 	info.mDecoderModel = VDXVideoSourceInfo::kDecoderModelCustom;
@@ -850,15 +3711,15 @@ void VDFFVideoSource::GetSampleInfo(sint64 sample_num, VDXVideoFrameInfo& frameI
 {
 	frameInfo.mBytePosition = -1;
 
-	frameInfo.mFrameType = kVDXVFT_Independent;
-
 	if ( IsKey(sample_num) )
 	{
-		
+		frameInfo.mFrameType = kVDXVFT_Independent;
 		frameInfo.mTypeChar = 'K';
 	}
 	else
 	{
+		//Depends on preceding samples up to keyframe;
+		frameInfo.mFrameType = kVDXVFT_Predicted;
 		frameInfo.mTypeChar = 'U';
 
 	}
@@ -867,6 +3728,20 @@ void VDFFVideoSource::GetSampleInfo(sint64 sample_num, VDXVideoFrameInfo& frameI
 
 bool VDFFVideoSource::IsKey(sint64 sample)
 {
+	if ( m_bKeyframesOnly )
+		return true;
+
+	return getKeyFrame( sample ) == sample;
+}
+
+sint64 VDFFVideoSource::getKeyFrame( sint64 sample )
+{
+	if ( m_bIntraOnly )
+		return sample;
+
+	//Demuxer may extend index while decode-ahead reads packets;
+	VDFFAutoLock lock( getSource() );
+
 	//EXPERIMENTAL:
 	if ( m_pStreamCtx->index_entries )
 	{
@@ -877,12 +3752,41 @@ bool VDFFVideoSource::IsKey(sint64 sample)
 		if ( index >= 0 )
 		{	
 			sint64 keySample = ts2pos( m_pStreamCtx->index_entries[index].timestamp );
-			if ( keySample == sample )
-				return true;
-			return false;
+			if ( keySample <= sample )
+				return keySample;
 		}
 	}
-	return true;
+	return sample;
+}
+
+bool VDFFVideoSource::getIndexKeyFrames( std::vector<sint64>& keyFrames )
+{
+	VDFFAutoLock lock( getSource() );
+
+	keyFrames.clear();
+
+	//Any sample starts segment;
+	if ( m_bIntraOnly )
+	{
+		for ( sint64 pos = 0; pos < m_streamInfo.mSampleCount; pos += PARALLEL_MIN_SEGMENT )
+			keyFrames.push_back( pos );
+		return !keyFrames.empty();
+	}
+
+	if ( m_pStreamCtx->nb_index_entries < 1 )
+		return false;
+
+	for ( int i = 0; i < m_pStreamCtx->nb_index_entries; ++i )
+	{
+		if ( m_pStreamCtx->index_entries[i].flags & AVINDEX_KEYFRAME )
+			keyFrames.push_back( ts2pos( m_pStreamCtx->index_entries[i].timestamp ) );
+	}
+
+	std::sort( keyFrames.begin(), keyFrames.end() );
+
+	//Index built while demuxing stops at read position;
+	sint64 posLast = ts2pos( m_pStreamCtx->index_entries[m_pStreamCtx->nb_index_entries - 1].timestamp );
+	return !keyFrames.empty() && posLast * 10 >= m_streamInfo.mSampleCount * 9;
 }
 
 sint64 VDFFVideoSource::GetFrameNumberForSample(sint64 sample_num)
@@ -897,6 +3801,11 @@ sint64 VDFFVideoSource::GetSampleNumberForFrame(sint64 display_num)
 
 sint64 VDFFVideoSource::GetRealFrame(sint64 display_num)
 {
+	display_num = m_duplicates.getOrigin( display_num );
+
+	if ( m_bKeyframesOnly )
+		return getKeyFrame( display_num );
+
 	return display_num;
 }
 
@@ -910,6 +3819,8 @@ sint64 VDFFVideoSource::GetSampleBytePosition(sint64 sample_num) {
 void VDFFVideoSource::Reset()
 {
 	m_posDesired = -1;
+	m_posModel = -1;
+	m_prerollSamples.clear();
 
 	//if ( m_avframe.data[0] == NULL )
 	//{
@@ -920,37 +3831,162 @@ void VDFFVideoSource::Reset()
 
 	/*if ( m_fmtBuffer != m_pixmap.format )
 	{
-		prepareFrameBuffer( &m_avframe, m_pixmap.format, &m_frameBuffer[0] );
+		prepareFrameBuffer( &m_avframe, m_pixmap.format, m_pFrameBase );
 		m_fmtBuffer = m_pixmap.format;
 	}*/
 }
 
 void VDFFVideoSource::SetDesiredFrame(sint64 frame_num)
 {
+	//Samples of abandoned chain are real reads again;
+	if ( frame_num != m_posDesired )
+		m_prerollSamples.clear();
+
 	m_posDesired = frame_num;
 	
 }
 
 sint64 VDFFVideoSource::GetNextRequiredSample(bool& is_preroll)
 {
-	if (m_posCurrent == m_posDesired)
-	{
-		is_preroll = false;
+	is_preroll = false;
 
+	if ( m_posDesired < 0 || m_posModel == m_posDesired )
 		return -1;
+
+	//Converted frame needs no preroll;
+	if ( isConverted( m_posDesired ) )
+	{
+		m_posModel = m_posDesired;
+		m_prerollSamples.erase( m_posDesired );
+		return m_posDesired;
 	}
 
-	sint64 posNext = m_posCurrent + 1;
+	//Restart from keyframe if decoder can't reach desired frame going forward;
+	sint64 posKey = m_bKeyframesOnly ? m_posDesired : getKeyFrame( m_posDesired );
+	sint64 posNext = m_posModel + 1;
 
-	is_preroll = false;
+	if ( m_posModel < 0 || m_posDesired < m_posModel || posKey > m_posModel )
+	{
+		posNext = posKey;
+		m_prerollSamples.clear();
+	}
+
+	m_posModel = posNext;
+
+	is_preroll = ( posNext != m_posDesired );
+
+	if ( is_preroll )
+		m_prerollSamples.insert( posNext );
+	else
+		m_prerollSamples.erase( posNext );
 
-	return m_posDesired;
+	return posNext;
 	
 }
 
 int VDFFVideoSource::GetRequiredCount() 
 {
-	return m_posDecode == -1 ? 0 : 1;
+	if ( m_posDesired < 0 || m_posModel == m_posDesired )
+		return 0;
+
+	if ( isConverted( m_posDesired ) )
+		return 1;
+
+	sint64 posKey = m_bKeyframesOnly ? m_posDesired : getKeyFrame( m_posDesired );
+
+	if ( m_posModel < 0 || m_posDesired < m_posModel || posKey > m_posModel )
+		return (int)( m_posDesired - posKey + 1 );
+
+	return (int)( m_posDesired - m_posModel );
+}
+
+//////////////////////////////////////////////////////////////////////////
+//Thumbnails
+//////////////////////////////////////////////////////////////////////////
+
+int VDFFVideoSource::ExtractThumbnails(const sint64 *pTimes, int count, int width, int height, void *pBuffer, ptrdiff_t pitch, bool *pExtracted)
+{
+	if ( !pTimes || count <= 0 || width <= 0 || height <= 0 || !pBuffer )
+		return 0;
+
+	//Failed slots stay cleared;
+	for ( int i = 0; i < count; ++i )
+	{
+		uint8* pSlot = (uint8*)pBuffer + i * height * pitch;
+		for ( int y = 0; y < height; ++y )
+			memset( pSlot + y * pitch, 0, width * 4 );
+
+		if ( pExtracted )
+			pExtracted[i] = false;
+	}
+
+	//Largest reduction still above thumbnail size;
+	int lowres = 0;
+	while ( lowres < 3 && 
+		( m_pStreamCtx->codec->coded_width >> ( lowres + 1 ) ) >= width &&
+		( m_pStreamCtx->codec->coded_height >> ( lowres + 1 ) ) >= height )
+		++lowres;
+
+	//Own decoder, source decoder keeps its position;
+	VDFFDecoderCursor cursor;
+	if ( !cursor.open( m_pFormatCtx->filename, getIndex(), lowres ) )
+		return 0;
+
+	//Keyframes only, cursor resets skipping on every packet;
+	cursor.setQuality( false, true );
+	AVCodecContext* pCodecCtx = cursor.getCodec();
+
+	//Visit keyframes in file order;
+	std::vector< std::pair<sint64, int> > requests;
+	for ( int i = 0; i < count; ++i )
+	{
+		int64 ts = m_tsStart + (int64)( pTimes[i] / 1000000.0 / av_q2d( m_pStreamCtx->time_base ) + 0.5 );
+		sint64 sample = FFMIN( FFMAX( ts2pos( ts ), 0 ), m_streamInfo.mSampleCount - 1 );
+		requests.push_back( std::make_pair( getKeyFrame( sample ), i ) );
+	}
+
+	std::sort( requests.begin(), requests.end() );
+
+	SwsContext* pSwsCtx = NULL;
+	std::vector<uint8> frame;
+	sint64 posDecoded = -1;
+	int extracted = 0;
+
+	for ( size_t i = 0; i < requests.size(); ++i )
+	{
+		sint64 posKey = requests[i].first;
+
+		if ( posKey != posDecoded )
+		{
+			int64 timestamp;
+			posDecoded = -1;
+			if ( !cursor.seek( pos2ts( posKey ) ) || !cursor.decodeNext( frame, timestamp ) )
+				continue;
+			posDecoded = posKey;
+		}
+
+		AVPicture picture;
+		avpicture_fill( &picture, &frame[0], pCodecCtx->pix_fmt, pCodecCtx->width, pCodecCtx->height );
+
+		pSwsCtx = sws_getCachedContext( pSwsCtx, pCodecCtx->width, pCodecCtx->height, pCodecCtx->pix_fmt,
+			width, height, PIX_FMT_BGRA, SWS_FAST_BILINEAR, NULL, NULL, NULL );
+		if ( !pSwsCtx )
+			break;
+
+		uint8_t* dstData[4] = { (uint8*)pBuffer + requests[i].second * height * pitch, NULL, NULL, NULL };
+		int dstStride[4] = { (int)pitch, 0, 0, 0 };
+
+		sws_scale( pSwsCtx, picture.data, picture.linesize, 0, pCodecCtx->height, dstData, dstStride );
+		++extracted;
+
+		if ( pExtracted )
+			pExtracted[requests[i].second] = true;
+	}
+
+	if ( pSwsCtx )
+		sws_freeContext( pSwsCtx );
+
+	return extracted;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -960,27 +3996,179 @@ int VDFFVideoSource::GetRequiredCount()
 const void *VDFFVideoSource::DecodeFrame(const void *inputBuffer, uint32 data_len, bool is_preroll, sint64 streamFrame, sint64 targetFrame) 
 {
 	//Check for dummy
-	uint8 *pOutBuffer = &m_frameBuffer[0];
-	uint8 *pInBuffer = &m_currentBuffer[0];
+	uint8 *pOutBuffer = m_pFrameBase;
+
+	//Preroll is decoded by Read of target, no need to convert it;
+	if ( is_preroll )
+		return pOutBuffer;
+
+	int flags = convertFlags();
+
+	EnterCriticalSection( &m_csOutput );
+
+	//Repeated picture marked by Read;
+	bool bDone = inputBuffer && data_len == 1 && m_duplicates.isDuplicate( streamFrame ) &&
+		m_duplicates.getOrigin( streamFrame ) == m_posDecode && isBufferCurrent();
 
-	if ( inputBuffer && data_len > 0 )
+	//Asked again (repaint), nothing to convert;
+	if ( !bDone && streamFrame == m_posDecode && isBufferCurrent() )
 	{
-		pInBuffer = (uint8_t*)inputBuffer;
+		m_outputCache.unpin( streamFrame, m_pixmap.format, m_bDraftActive, flags );
+		bDone = true;
 	}
 
-	AVPicture avpicture, *pPicture = &avpicture;
+	if ( !bDone && m_outputCache.restore( streamFrame, m_pixmap.format, m_bDraftActive, flags, pOutBuffer ) )
+	{
+		m_posDecode = streamFrame;
+		m_fmtBuffer = m_pixmap.format;
+		m_bDraftBuffer = m_bDraftActive;
+		m_flagsBuffer = flags;
+		bDone = true;
+	}
 
-	avpicture_fill( pPicture, pInBuffer, 
-		m_pCodecCtx->pix_fmt, m_pCodecCtx->width,m_pCodecCtx->height );
+	//Finished by decode-ahead thread, its buffer becomes frame buffer without copy;
+	if ( !bDone && inputBuffer && data_len == 1 && takeConvertedFrame( streamFrame, flags ) )
+		bDone = true;
+
+	LeaveCriticalSection( &m_csOutput );
+
+	if ( bDone )
+		return m_pFrameBase;
+
+	uint32 rawSize = (uint32)avpicture_get_size( m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height );
+
+	//Decode-ahead thread may replace current buffer;
+	VDFFAutoLock lock( getSource() );
 
-	prepareFrameBuffer( pPicture, m_pixmap.format, pOutBuffer );
+	uint8 *pInBuffer = (uint8_t*)inputBuffer;
+
+	//Current buffer belongs to whatever was decoded last, decode requested sample again;
+	if ( !inputBuffer || data_len <= 1 )
+	{
+		if ( !decodeToSample( streamFrame ) || m_currentBuffer.size() < rawSize )
+			return pOutBuffer;
+		pInBuffer = &m_currentBuffer[0];
+	}
+
+	uint32 size = convertFrame( pInBuffer, pOutBuffer );
+
+	EnterCriticalSection( &m_csOutput );
 
 	m_posDecode = streamFrame;
+	m_fmtBuffer = m_pixmap.format;
+	m_bDraftBuffer = m_bDraftActive;
+	m_flagsBuffer = flags;
+
+	//Playback never comes back, keep random requests only;
+	if ( m_nSequentialTargets < OUTPUT_CACHE_SEQUENTIAL )
+		m_outputCache.store( streamFrame, m_fmtBuffer, m_bDraftBuffer, m_flagsBuffer, pOutBuffer, size );
+
+	LeaveCriticalSection( &m_csOutput );
 
 	return pOutBuffer;
 	
 }
 
+uint32 VDFFVideoSource::convertFrame( uint8* pRaw, void* pFrameBuffer )
+{
+	AVPicture picture;
+	avpicture_fill( &picture, pRaw, 
+		m_pCodecCtx->pix_fmt, m_pCodecCtx->width,m_pCodecCtx->height );
+
+	if ( !isPassthrough( m_pixmap.format ) )
+		return prepareFrameBuffer( &picture, m_pixmap.format, pFrameBuffer );
+
+	//Decoder planes copied row by row into pixmap layout, no conversion;
+	AVPicture dst;
+	for ( int i = 0; i < 4; ++i )
+	{
+		dst.data[i] = ( i < 3 && m_planeStride[i] ) ? (uint8*)pFrameBuffer + m_planeOffset[i] : NULL;
+		dst.linesize[i] = ( i < 3 ) ? m_planeStride[i] : 0;
+	}
+
+	av_picture_copy( &dst, &picture, m_pCodecCtx->pix_fmt, m_pCodecCtx->width, m_pCodecCtx->height );
+
+	return m_frameSize;
+}
+
+bool VDFFVideoSource::convertAheadFrame( AheadFrame& frame )
+{
+	//Target format is settled once frame was converted with it;
+	EnterCriticalSection( &m_csOutput );
+	bool bSettled = m_fmtBuffer == m_pixmap.format;
+	LeaveCriticalSection( &m_csOutput );
+
+	if ( !m_bFusedConvert || m_pFrameBase == NULL || !bSettled || m_currentBuffer.empty() )
+		return false;
+
+	//Same size as frame buffer, it takes frame buffer's place later;
+	frame.data.resize( m_frameSize + OUTPUT_ALIGN );
+
+	frame.bConverted	= true;
+	frame.format		= m_pixmap.format;
+	frame.layout		= m_layoutGeneration;
+	frame.bDraft		= m_bDraftActive;
+	frame.flags			= convertFlags();
+	frame.hash			= 0;
+
+	//Decoded picture is still in cache;
+	if ( m_duplicates.isActive() )
+		frame.hash = VDFFHash( &m_currentBuffer[0], m_currentBuffer.size() ) | 1;
+
+	convertFrame( &m_currentBuffer[0], VDFFAlignedBase( frame.data ) );
+
+	return true;
+}
+
+bool VDFFVideoSource::takeConvertedFrame( sint64 sample, int flags )
+{
+	EnterCriticalSection( &m_csAhead );
+
+	std::list<AheadFrame>::iterator it = m_convertedFrames.begin();
+	while ( it != m_convertedFrames.end() && it->pos != sample )
+		++it;
+
+	//Target format or decoder quality changed since, decoded picture is gone;
+	bool bTaken = it != m_convertedFrames.end() && it->format == m_pixmap.format &&
+		it->layout == m_layoutGeneration && it->bDraft == m_bDraftActive && it->flags == flags &&
+		it->data.size() == m_frameBuffer.size();
+
+	if ( bTaken )
+	{
+		m_frameBuffer.swap( it->data );
+		rebaseFrameBuffer();
+
+		m_posDecode = sample;
+		m_fmtBuffer = m_pixmap.format;
+		m_bDraftBuffer = it->bDraft;
+		m_flagsBuffer = it->flags;
+	}
+
+	if ( it != m_convertedFrames.end() )
+	{
+		m_spareBuffers.push_back( std::vector<uint8>() );
+		m_spareBuffers.back().swap( it->data );
+		m_convertedFrames.erase( it );
+	}
+
+	LeaveCriticalSection( &m_csAhead );
+
+	return bTaken;
+}
+
+void VDFFVideoSource::rebaseFrameBuffer( void )
+{
+	uint8* pBase = VDFFAlignedBase( m_frameBuffer );
+
+	m_pFrameBase = pBase;
+	m_pixmap.data = pBase + m_planeOffset[0];
+	if ( m_pixmap.data2 )
+	{
+		m_pixmap.data2 = pBase + m_planeOffset[1];
+		m_pixmap.data3 = pBase + m_planeOffset[2];
+	}
+}
+
 uint32 VDFFVideoSource::GetDecodePadding() 
 {
 	return 0;
@@ -989,25 +4177,140 @@ uint32 VDFFVideoSource::GetDecodePadding()
 
 bool VDFFVideoSource::IsFrameBufferValid()
 {
-	return ((m_posDecode >= 0) && ( m_fmtBuffer == m_pixmap.format));
+	//Draft or preview scaled frame is replaced once final one is wanted;
+	EnterCriticalSection( &m_csOutput );
+	bool bValid = ( m_posDecode >= 0 ) && isBufferCurrent();
+	LeaveCriticalSection( &m_csOutput );
+
+	return bValid;
 }
 
 const VDXPixmap& VDFFVideoSource::GetFrameBuffer()
 {
-	
 	return m_pixmap;
 }
 
+bool VDFFVideoSource::isConverted( sint64 sample, bool bPin )
+{
+	int flags = convertFlags();
+
+	EnterCriticalSection( &m_csOutput );
+
+	//Cached copy survives frame buffer reuse by DecodeFrame of other samples;
+	bool bConverted = bPin ? m_outputCache.pin( sample, m_pixmap.format, m_bDraftActive, flags ) :
+		m_outputCache.contains( sample, m_pixmap.format, m_bDraftActive, flags );
+
+	if ( !bConverted )
+		bConverted = sample == m_posDecode && isBufferCurrent();
+
+	LeaveCriticalSection( &m_csOutput );
+
+	return bConverted;
+}
+
+bool VDFFVideoSource::isPassthrough( int format ) const
+{
+	if ( m_bDecimate || m_pixmap.w != m_pCodecCtx->width || m_pixmap.h != m_pCodecCtx->height )
+		return false;
+
+	switch ( format )
+	{
+	case nsVDXPixmap::kPixFormat_YUV444_Planar:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_YUV444P;
+
+	case nsVDXPixmap::kPixFormat_YUV422_Planar:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_YUV422P;
+
+	case nsVDXPixmap::kPixFormat_YUV420_Planar:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_YUV420P;
+
+	case nsVDXPixmap::kPixFormat_YUV411_Planar:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_YUV411P;
+
+	case nsVDXPixmap::kPixFormat_YUV410_Planar:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_YUV410P;
+
+	case nsVDXPixmap::kPixFormat_Y8:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_GRAY8;
+
+	case nsVDXPixmap::kPixFormat_YUV422_UYVY:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_UYVY422;
+
+	case nsVDXPixmap::kPixFormat_YUV422_YUYV:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_YUYV422;
+
+	case nsVDXPixmap::kPixFormat_XRGB1555:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_RGB555;
+
+	case nsVDXPixmap::kPixFormat_RGB565:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_RGB565;
+
+	case nsVDXPixmap::kPixFormat_RGB888:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_BGR24;
+
+	case nsVDXPixmap::kPixFormat_XRGB8888:
+		return m_pCodecCtx->pix_fmt == PIX_FMT_BGRA;
+	}
+
+	return false;
+}
+
 bool VDFFVideoSource::SetTargetFormat(int format, bool useDIBAlignment)
 {
 	if (format == 0)
 	{
+		//Same chroma subsampling, no round trip through RGB;
+		//full range YUVJ doesn't fit limited range planar formats, goes to RGB;
 		switch (m_pCodecCtx->pix_fmt)
 		{
 		case PIX_FMT_YUV420P:
+		case PIX_FMT_NV12:
+		case PIX_FMT_NV21:
+		case PIX_FMT_YUV420P9LE:
+		case PIX_FMT_YUV420P9BE:
+		case PIX_FMT_YUV420P10LE:
+		case PIX_FMT_YUV420P10BE:
+		case PIX_FMT_YUV420P16LE:
+		case PIX_FMT_YUV420P16BE:
 			format = nsVDXPixmap::kPixFormat_YUV420_Planar;
 			break;
 
+		case PIX_FMT_YUV422P:
+		case PIX_FMT_YUV422P9LE:
+		case PIX_FMT_YUV422P9BE:
+		case PIX_FMT_YUV422P10LE:
+		case PIX_FMT_YUV422P10BE:
+		case PIX_FMT_YUV422P16LE:
+		case PIX_FMT_YUV422P16BE:
+			format = nsVDXPixmap::kPixFormat_YUV422_Planar;
+			break;
+
+		case PIX_FMT_YUV444P:
+		case PIX_FMT_YUV440P:
+		case PIX_FMT_YUV444P9LE:
+		case PIX_FMT_YUV444P9BE:
+		case PIX_FMT_YUV444P10LE:
+		case PIX_FMT_YUV444P10BE:
+		case PIX_FMT_YUV444P16LE:
+		case PIX_FMT_YUV444P16BE:
+			format = nsVDXPixmap::kPixFormat_YUV444_Planar;
+			break;
+
+		case PIX_FMT_YUV411P:
+		case PIX_FMT_UYYVYY411:
+			format = nsVDXPixmap::kPixFormat_YUV411_Planar;
+			break;
+
+		case PIX_FMT_YUV410P:
+			format = nsVDXPixmap::kPixFormat_YUV410_Planar;
+			break;
+
+		case PIX_FMT_GRAY8:
+		case PIX_FMT_GRAY16LE:
+		case PIX_FMT_GRAY16BE:
+			format = nsVDXPixmap::kPixFormat_Y8;
+			break;
+
 		case PIX_FMT_UYVY422:
 			format = nsVDXPixmap::kPixFormat_YUV422_UYVY;
 			break;
@@ -1018,6 +4321,10 @@ bool VDFFVideoSource::SetTargetFormat(int format, bool useDIBAlignment)
 
 		case PIX_FMT_RGB555:
 		case PIX_FMT_BGR555:
+			format = nsVDXPixmap::kPixFormat_XRGB1555;
+			break;
+
+		case PIX_FMT_RGB565:
 			format = nsVDXPixmap::kPixFormat_RGB565;
 			break;
 
@@ -1026,130 +4333,152 @@ bool VDFFVideoSource::SetTargetFormat(int format, bool useDIBAlignment)
 			format = nsVDXPixmap::kPixFormat_RGB888;
 			break;
 
+		case PIX_FMT_BGRA:
+		case PIX_FMT_RGBA:
+		case PIX_FMT_ARGB:
+		case PIX_FMT_ABGR:
+			format = nsVDXPixmap::kPixFormat_XRGB8888;
+			break;
+
 		default:
 			format = nsVDXPixmap::kPixFormat_RGB888;
 			break;
 
 		}
+
+		//Full range flagged by stream itself;
+		if ( m_pCodecCtx->color_range == AVCOL_RANGE_JPEG && format != nsVDXPixmap::kPixFormat_XRGB1555 &&
+			format != nsVDXPixmap::kPixFormat_RGB565 && format != nsVDXPixmap::kPixFormat_XRGB8888 )
+			format = nsVDXPixmap::kPixFormat_RGB888;
 	}
 
 	const sint32 w = m_pixmap.w;
 	const sint32 h =  m_pixmap.h;
-	
-	m_frameBuffer.resize( m_pixmap.w* m_pixmap.h*4 );
 
-	uint8 *pBuffer = &m_frameBuffer[0];
-
-	m_pixmap.data			= pBuffer;
-	m_pixmap.palette		= NULL;
-	m_pixmap.format			= format;
-	//m_pixmap.w				= m_pCodecCtx->width;
-	//m_pixmap.h				= m_pCodecCtx->height;
-	m_pixmap.pitch			= 0;
-	m_pixmap.data2			= NULL;
-	m_pixmap.pitch2			= 0;
-	m_pixmap.data3			= NULL;
-	m_pixmap.pitch3			= 0;
+	//Row bytes and rows of every plane;
+	int planes = 1;
+	int rowBytes[3] = { 0, 0, 0 };
+	int rows[3] = { h, 0, 0 };
+	bool bFlip = false;
 
 	switch(format) 
 	{
+	case nsVDXPixmap::kPixFormat_YUV444_Planar:
+	case nsVDXPixmap::kPixFormat_YUV422_Planar:
 	case nsVDXPixmap::kPixFormat_YUV420_Planar:
+	case nsVDXPixmap::kPixFormat_YUV411_Planar:
+	case nsVDXPixmap::kPixFormat_YUV410_Planar:
 		{
-			m_pixmap.data	= pBuffer;
-			m_pixmap.pitch	= w;
-			m_pixmap.data2	= pBuffer += w*h;
-			m_pixmap.pitch2 = w >> 1;
-			m_pixmap.data3	= pBuffer += (w*h >> 2);
-			m_pixmap.pitch3 = w >> 1;
+			int wChroma, hChroma;
+			VDFFPlanarLayout( format, w, h, wChroma, hChroma );
+
+			planes = 3;
+			rowBytes[0] = w;
+			rowBytes[1] = rowBytes[2] = wChroma;
+			rows[1] = rows[2] = hChroma;
 		}
 		break;
 
 	case nsVDXPixmap::kPixFormat_Y8:
-		{
-			m_pixmap.data	= pBuffer;
-			m_pixmap.pitch	= w;
-
-		}
+		//Scaler writes 4:2:0, chroma is kept behind pixmap;
+		planes = 3;
+		rowBytes[0] = w;
+		rowBytes[1] = rowBytes[2] = ( w + 1 ) >> 1;
+		rows[1] = rows[2] = ( h + 1 ) >> 1;
 		break;
 
 	case nsVDXPixmap::kPixFormat_YUV422_UYVY:
-
-		m_pixmap.data	= pBuffer;
-		m_pixmap.pitch	= w*2;
-
-		break;
-
 	case nsVDXPixmap::kPixFormat_YUV422_YUYV:
-
-		m_pixmap.data	= pBuffer;
-		m_pixmap.pitch	= w*2;
-		
+		//Pixel pairs share chroma, odd width takes whole pair;
+		rowBytes[0] = ( ( w + 1 ) & ~1 ) * 2;
 		break;
 
 	case nsVDXPixmap::kPixFormat_XRGB1555:
+	case nsVDXPixmap::kPixFormat_RGB565:
+		rowBytes[0] = w*2;
+		bFlip = useDIBAlignment;
+		break;
 
-		if ( useDIBAlignment )
-		{
-			m_pixmap.data	= pBuffer + w*2*(h-1);
-			m_pixmap.pitch	=  -w*2;
-
-		} else
-		{
-			m_pixmap.data	= pBuffer;
-			m_pixmap.pitch	= w*2;
-		}
-
+	case nsVDXPixmap::kPixFormat_RGB888:
+		rowBytes[0] = w*3;
+		bFlip = useDIBAlignment;
 		break;
 
-	case nsVDXPixmap::kPixFormat_RGB565:
+	case nsVDXPixmap::kPixFormat_XRGB8888:
+		rowBytes[0] = w*4;
+		bFlip = useDIBAlignment;
+		break;
 
-		if ( useDIBAlignment )
-		{
-			m_pixmap.data	= pBuffer + w*2*(h-1);
-			m_pixmap.pitch	=  -w*2;
+	default:
+		return false;
+		break;
+	}
 
-		} else
-		{
-			m_pixmap.data	= pBuffer;
-			m_pixmap.pitch	= w*2;
-		}
+	//Decode-ahead thread converts with current layout;
+	VDFFAutoLock lock( getSource() );
 
-		break;
+	if ( format != m_pixmap.format || bFlip != m_bFlipBuffer )
+		++m_layoutGeneration;
 
-	case nsVDXPixmap::kPixFormat_RGB888:
+	//Planes follow each other, padded to alignment if asked;
+	const size_t align = m_bAlignedRows ? OUTPUT_ALIGN : 1;
+	int pitch[3];
+	size_t offset[3];
+	size_t size = 0;
 
-		if ( useDIBAlignment )
-		{
-			m_pixmap.data	= pBuffer + w*3*(h-1);
-			m_pixmap.pitch	=  -w*3;
+	for ( int i = 0; i < planes; ++i )
+	{
+		pitch[i] = (int)( ( rowBytes[i] + align - 1 ) & ~( align - 1 ) );
+		offset[i] = size;
+		size += ( (size_t)pitch[i] * rows[i] + align - 1 ) & ~( align - 1 );
+	}
 
-		} else
-		{
-			m_pixmap.data	= pBuffer;
-			m_pixmap.pitch	= w*3;
-		}
+	m_frameBuffer.resize( size + OUTPUT_ALIGN );
 
-		break;
+	uint8 *pBuffer = VDFFAlignedBase( m_frameBuffer );
 
-	case nsVDXPixmap::kPixFormat_XRGB8888:
+	//Converted frame doesn't match new layout;
+	if ( pBuffer != m_pFrameBase || bFlip != m_bFlipBuffer )
+	{
+		EnterCriticalSection( &m_csOutput );
+		m_fmtBuffer = 0;
+		m_outputCache.clear();
+		LeaveCriticalSection( &m_csOutput );
+	}
 
-		if ( useDIBAlignment )
-		{
-			m_pixmap.data	= pBuffer + w*4*(h-1);
-			m_pixmap.pitch	= -w*4;
+	m_pFrameBase = pBuffer;
+	m_frameSize = (uint32)size;
+	m_bFlipBuffer = bFlip;
 
-		} else
-		{
-			m_pixmap.data	= pBuffer;
-			m_pixmap.pitch	= w*4;
-		}
+	for ( int i = 0; i < 3; ++i )
+	{
+		m_planeOffset[i] = ( i < planes ) ? (ptrdiff_t)offset[i] : 0;
+		m_planeStride[i] = ( i < planes ) ? pitch[i] : 0;
+	}
 
+	if ( bFlip )
+	{
+		m_planeOffset[0] += (ptrdiff_t)pitch[0] * ( h - 1 );
+		m_planeStride[0] = -pitch[0];
+	}
 
-		break;
+	m_pixmap.data			= pBuffer + m_planeOffset[0];
+	m_pixmap.palette		= NULL;
+	m_pixmap.format			= format;
+	//m_pixmap.w				= m_pCodecCtx->width;
+	//m_pixmap.h				= m_pCodecCtx->height;
+	m_pixmap.pitch			= m_planeStride[0];
+	m_pixmap.data2			= NULL;
+	m_pixmap.pitch2			= 0;
+	m_pixmap.data3			= NULL;
+	m_pixmap.pitch3			= 0;
 
-	default:
-		return false;
-		break;
+	if ( planes == 3 && format != nsVDXPixmap::kPixFormat_Y8 )
+	{
+		m_pixmap.data2	= pBuffer + m_planeOffset[1];
+		m_pixmap.pitch2 = m_planeStride[1];
+		m_pixmap.data3	= pBuffer + m_planeOffset[2];
+		m_pixmap.pitch3 = m_planeStride[2];
 	}
 
 	return true;
@@ -1163,7 +4492,7 @@ bool VDFFVideoSource::SetDecompressedFormat(const VDXBITMAPINFOHEADER *pbih)
 const void *VDFFVideoSource::GetFrameBufferBase()
 {
 	
-	return &m_frameBuffer[0];
+	return m_pFrameBase;
 }
 
 bool VDFFVideoSource::IsDecodable(sint64 sample_num64) 
@@ -1174,14 +4503,20 @@ bool VDFFVideoSource::IsDecodable(sint64 sample_num64)
 
 int64 VDFFVideoSource::pos2ts( sint64 num ) const
 {
-	double scale = m_pStreamCtx->r_frame_rate.den *m_pStreamCtx->time_base.den /(double)( m_pStreamCtx->r_frame_rate.num *m_pStreamCtx->time_base.num );
+	if ( !m_timecodes.empty() )
+		return m_timecodes.pos2ts( num ) + m_tsStart;
+
+	double scale = m_frameRate.den *(double)m_pStreamCtx->time_base.den /( m_frameRate.num *(double)m_pStreamCtx->time_base.num );
 	return  (int64)(num*scale + 0.5) + m_tsStart;
 	
 }
 
 sint64 VDFFVideoSource::ts2pos( int64 ts ) const
 {
-	double scale = m_pStreamCtx->r_frame_rate.num *m_pStreamCtx->time_base.num /(double)( m_pStreamCtx->r_frame_rate.den *m_pStreamCtx->time_base.den );
+	if ( !m_timecodes.empty() )
+		return m_timecodes.ts2pos( ts - m_tsStart );
+
+	double scale = m_frameRate.num *(double)m_pStreamCtx->time_base.num /( m_frameRate.den *(double)m_pStreamCtx->time_base.den );
 	return  (sint64)((ts-m_tsStart)*scale + 0.5 );
 }
 
@@ -1666,6 +5001,9 @@ uint32 VDFFAudioSource::decodeFramePacket( uint8_t  *&pBuffer, AVPacket* pPacket
 
 bool VDFFAudioSource::Read(sint64 lStart64, uint32 lCount, void *lpBuffer, uint32 cbBuffer, uint32 *lBytesRead, uint32 *lSamplesRead)
 {
+	//Video may be decoded ahead on other thread;
+	VDFFAutoLock lock( getSource() );
+
 	uint32 bytesPerSample = (uint32)m_pCodecCtx->request_channels*av_get_bytes_per_sample(SAMPLE_FMT_S16);
 	if ( lpBuffer && cbBuffer < bytesPerSample )
 		return false;
@@ -1855,25 +5193,98 @@ bool VDFFInputFileOptions::Read(const void *src, uint32 len) {
 		return false;
 
 	const char *args = (const char *)src + sizeof(Header);
+	const char *argsEnd = args + hdr.arglen;
 
 	bAdjustPAR = *args;
 	args += sizeof( bAdjustPAR );
 	bAudioDownmix = *args;
+	args += sizeof( bAudioDownmix );
+
+	//Options added later, older settings keep defaults;
+	if ( args < argsEnd )
+		bTimecodes = *args;
+	args += sizeof( bTimecodes );
+	if ( args < argsEnd )
+		bKeyframesOnly = *args;
+	args += sizeof( bKeyframesOnly );
+	if ( args < argsEnd )
+		bLowres = *args;
+	args += sizeof( bLowres );
+	if ( args < argsEnd )
+		bDraftDecode = *args;
+	args += sizeof( bDraftDecode );
+	if ( args < argsEnd )
+		bDecodeAhead = *args;
+	args += sizeof( bDecodeAhead );
+	if ( args < argsEnd )
+		bParallelDecode = *args;
+	args += sizeof( bParallelDecode );
+	if ( args < argsEnd )
+		bDecoderPool = *args;
+	args += sizeof( bDecoderPool );
+	if ( args < argsEnd )
+		bDuplicates = *args;
+	args += sizeof( bDuplicates );
+	if ( args < argsEnd )
+		bAlignedRows = *args;
+	args += sizeof( bAlignedRows );
+	if ( args < argsEnd )
+		bPreviewScaler = *args;
+	args += sizeof( bPreviewScaler );
+	if ( args < argsEnd )
+		bExportScaler = *args;
+	args += sizeof( bExportScaler );
+	if ( args < argsEnd )
+		bAccurateRnd = *args;
+	args += sizeof( bAccurateRnd );
+	if ( args < argsEnd )
+		bFusedConvert = *args;
+	args += sizeof( bFusedConvert );
 	
 	return true;
 }
 
 uint32 VDXAPIENTRY VDFFInputFileOptions::Write(void *buf, uint32 buflen)
 {
-	uint32 required = sizeof(Header) + sizeof(bAdjustPAR) + sizeof( bAudioDownmix ) + 1;
+	const uint16 arglen = sizeof(bAdjustPAR) + sizeof( bAudioDownmix ) + sizeof( bTimecodes ) +
+		sizeof( bKeyframesOnly ) + sizeof( bLowres ) + sizeof( bDraftDecode ) + sizeof( bDecodeAhead ) +
+		sizeof( bParallelDecode ) + sizeof( bDecoderPool ) + sizeof( bDuplicates ) + sizeof( bAlignedRows ) +
+		sizeof( bPreviewScaler ) + sizeof( bExportScaler ) + sizeof( bAccurateRnd ) + sizeof( bFusedConvert );
+	uint32 required = sizeof(Header) + arglen + 1;
 	if (buf) {
-		const Header hdr = { kSignature, required, 1, sizeof(bAdjustPAR) + sizeof( bAudioDownmix ) };
+		const Header hdr = { kSignature, required, 1, arglen };
 
 		memcpy(buf, &hdr, sizeof(Header));
 		byte* pBuf = (byte *)buf + sizeof(Header);
 		*pBuf = bAdjustPAR;
 		pBuf += sizeof(bAdjustPAR);
 		*pBuf = bAudioDownmix;
+		pBuf += sizeof(bAudioDownmix);
+		*pBuf = bTimecodes;
+		pBuf += sizeof(bTimecodes);
+		*pBuf = bKeyframesOnly;
+		pBuf += sizeof(bKeyframesOnly);
+		*pBuf = bLowres;
+		pBuf += sizeof(bLowres);
+		*pBuf = bDraftDecode;
+		pBuf += sizeof(bDraftDecode);
+		*pBuf = bDecodeAhead;
+		pBuf += sizeof(bDecodeAhead);
+		*pBuf = bParallelDecode;
+		pBuf += sizeof(bParallelDecode);
+		*pBuf = bDecoderPool;
+		pBuf += sizeof(bDecoderPool);
+		*pBuf = bDuplicates;
+		pBuf += sizeof(bDuplicates);
+		*pBuf = bAlignedRows;
+		pBuf += sizeof(bAlignedRows);
+		*pBuf = bPreviewScaler;
+		pBuf += sizeof(bPreviewScaler);
+		*pBuf = bExportScaler;
+		pBuf += sizeof(bExportScaler);
+		*pBuf = bAccurateRnd;
+		pBuf += sizeof(bAccurateRnd);
+		*pBuf = bFusedConvert;
 	}
 
 	return required;
@@ -1964,8 +5375,12 @@ public:
 	virtual bool readFrame( IFFStream* pStream );
 	virtual bool seekFrame(  IFFStream* pStream, int64 timestamp, bool backward = true );
 
+	virtual void lock( void ) { EnterCriticalSection( &m_csSource ); }
+	virtual void unlock( void ) { LeaveCriticalSection( &m_csSource ); }
+
 protected:
 	AVFormatContext				*m_pFormatCtx;
+	CRITICAL_SECTION			m_csSource;
 
 	std::vector<IFFStream*>		m_streams;
 	VDFFOptions					m_options;
@@ -1977,6 +5392,8 @@ VDFFInputFile::VDFFInputFile(const VDXInputDriverContext& context)
 	: mContext(context),
 	m_pFormatCtx(NULL)
 {
+	InitializeCriticalSection( &m_csSource );
+
 	/* register all codecs, demux and protocols */
 	avcodec_register_all();
 	// Register all formats and codecs
@@ -1991,6 +5408,7 @@ VDFFInputFile::~VDFFInputFile()
 	if ( m_pFormatCtx )
 		av_close_input_file(m_pFormatCtx);	
 
+	DeleteCriticalSection( &m_csSource );
 }
 
 void VDFFInputFile::Init(const wchar_t *szFile, IVDXInputOptions *opts) 
@@ -2403,6 +5821,116 @@ INT_PTR VDFFInputFileOptionsDialog::DlgProc(UINT msg, WPARAM wParam, LPARAM lPar
 			else
 				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
 
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_TIMECODES);
+
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Constant frame rate");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Frame timecodes");
+
+		if ( m_pOpts )
+			SendMessage(hwnd,CB_SETCURSEL,(WPARAM)m_pOpts->bTimecodes,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_KEYFRAMESONLY);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bKeyframesOnly == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_LOWRES);
+
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Full");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"1/2");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"1/4");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"1/8");
+
+		if ( m_pOpts )
+			SendMessage(hwnd,CB_SETCURSEL,(WPARAM)m_pOpts->bLowres,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_DRAFTDECODE);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bDraftDecode == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_DECODEAHEAD);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bDecodeAhead == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_PARALLELDECODE);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bParallelDecode == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_DECODERPOOL);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bDecoderPool == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_DUPLICATES);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bDuplicates == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_ALIGNEDROWS);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bAlignedRows == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_PREVIEWSCALER);
+
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Fast bilinear");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Bilinear");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Bicubic");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Lanczos");
+
+		if ( m_pOpts )
+			SendMessage(hwnd,CB_SETCURSEL,(WPARAM)m_pOpts->bPreviewScaler,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_EXPORTSCALER);
+
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Fast bilinear");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Bilinear");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Bicubic");
+		SendMessage(hwnd,CB_ADDSTRING,0,(LPARAM)"Lanczos");
+
+		if ( m_pOpts )
+			SendMessage(hwnd,CB_SETCURSEL,(WPARAM)m_pOpts->bExportScaler,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_ACCURATERND);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bAccurateRnd == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
+		hwnd = GetDlgItem(mhdlg, IDC_VIDEO_FUSEDCONVERT);
+
+		if ( m_pOpts )
+			if ( m_pOpts->bFusedConvert == 1 )
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_CHECKED,0);
+			else
+				SendMessage(hwnd,BM_SETCHECK,(WPARAM)BST_UNCHECKED,0);
+
 	}
 	if (msg == WM_COMMAND) {
 		switch(LOWORD(wParam)) 
@@ -2427,6 +5955,110 @@ INT_PTR VDFFInputFileOptionsDialog::DlgProc(UINT msg, WPARAM wParam, LPARAM lPar
 					if(state == BST_CHECKED && m_pOpts) 
 						m_pOpts->bAudioDownmix = 1;
 
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_TIMECODES);
+
+					state = SendMessage(hwnd,CB_GETCURSEL,0,0);
+
+					m_pOpts->bTimecodes = VDFFOptions::kTimecodesFrame;
+					if(state >= 0 && m_pOpts) 
+						m_pOpts->bTimecodes = (byte)state;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_KEYFRAMESONLY);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bKeyframesOnly = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bKeyframesOnly = 1;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_LOWRES);
+
+					state = SendMessage(hwnd,CB_GETCURSEL,0,0);
+
+					m_pOpts->bLowres = 0;
+					if(state >= 0 && m_pOpts) 
+						m_pOpts->bLowres = (byte)state;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_DRAFTDECODE);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bDraftDecode = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bDraftDecode = 1;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_DECODEAHEAD);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bDecodeAhead = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bDecodeAhead = 1;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_PARALLELDECODE);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bParallelDecode = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bParallelDecode = 1;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_DECODERPOOL);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bDecoderPool = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bDecoderPool = 1;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_DUPLICATES);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bDuplicates = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bDuplicates = 1;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_ALIGNEDROWS);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bAlignedRows = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bAlignedRows = 1;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_PREVIEWSCALER);
+
+					state = SendMessage(hwnd,CB_GETCURSEL,0,0);
+
+					m_pOpts->bPreviewScaler = VDFFOptions::kScalerFastBilinear;
+					if(state >= 0 && m_pOpts) 
+						m_pOpts->bPreviewScaler = (byte)state;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_EXPORTSCALER);
+
+					state = SendMessage(hwnd,CB_GETCURSEL,0,0);
+
+					m_pOpts->bExportScaler = VDFFOptions::kScalerLanczos;
+					if(state >= 0 && m_pOpts) 
+						m_pOpts->bExportScaler = (byte)state;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_ACCURATERND);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bAccurateRnd = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bAccurateRnd = 1;
+
+					hwnd = GetDlgItem(mhdlg, IDC_VIDEO_FUSEDCONVERT);
+
+					state = SendMessage(hwnd,BM_GETCHECK,0,0);
+
+					m_pOpts->bFusedConvert = 0;
+					if(state == BST_CHECKED && m_pOpts) 
+						m_pOpts->bFusedConvert = 1;
+
 				}
 				EndDialog(mhdlg, TRUE);
 				return TRUE;
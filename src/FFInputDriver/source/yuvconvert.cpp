@@ -0,0 +1,341 @@
+//	yuvconvert.cpp - FFMpeg Input Driver Plugin for Virtual Dub, unscaled YUV kernels;
+//	Copyright (C) 2011 Andrey Kovalchuk
+
+//	This software is provided 'as-is', without any express or implied
+//	warranty.  In no event will the authors be held liable for any
+//	damages arising from the use of this software.
+//
+//	Permission is granted to anyone to use this software for any purpose,
+//	including commercial applications, and to alter it and redistribute it
+//	freely, subject to the following restrictions:
+//
+//	1.	The origin of this software must not be misrepresented; you must
+//		not claim that you wrote the original software. If you use this
+//		software in a product, an acknowledgment in the product
+//		documentation would be appreciated but is not required.
+//	2.	Altered source versions must be plainly marked as such, and must
+//		not be misrepresented as being the original software.
+//	3.	This notice may not be removed or altered from any source
+//		distribution.
+
+
+#include "yuvconvert.h"
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <intrin.h>
+
+//Coefficients in 1/8192;
+#define YUV_COEF_BITS	13
+
+namespace
+{
+	struct Coeffs
+	{
+		int		yoff;
+		int		cy;
+		int		rv;
+		int		gu;
+		int		gv;
+		int		bu;
+	};
+
+	enum
+	{
+		kCpuSSE2	= 1,
+		kCpuSSSE3	= 2,
+	};
+
+	typedef void (*TRowFunc)( const uint8* pY, const uint8* pU, const uint8* pV, int uvStep, uint8* pDst, int w, const Coeffs& k );
+	typedef void (*TReduceFunc)( const uint16* pSrc, uint8* pDst, int w, int shift, const uint16* pDither );
+
+	//Bayer matrix, thresholds 0..63;
+	const uint8 kDither8x8[8][8] =
+	{
+		{  0, 32,  8, 40,  2, 34, 10, 42 },
+		{ 48, 16, 56, 24, 50, 18, 58, 26 },
+		{ 12, 44,  4, 36, 14, 46,  6, 38 },
+		{ 60, 28, 52, 20, 62, 30, 54, 22 },
+		{  3, 35, 11, 43,  1, 33,  9, 41 },
+		{ 51, 19, 59, 27, 49, 17, 57, 25 },
+		{ 15, 47,  7, 39, 13, 45,  5, 37 },
+		{ 63, 31, 55, 23, 61, 29, 53, 21 },
+	};
+
+	int cpuFeatures( void )
+	{
+		static int features = -1;
+
+		if ( features < 0 )
+		{
+			int info[4];
+			__cpuid( info, 1 );
+
+			int flags = 0;
+			if ( info[3] & ( 1 << 26 ) )
+				flags |= kCpuSSE2;
+			if ( info[2] & ( 1 << 9 ) )
+				flags |= kCpuSSSE3;
+			features = flags;
+		}
+
+		return features;
+	}
+
+	void setupCoeffs( Coeffs& k, int matrix, bool bFullRange )
+	{
+		//Kr, Kb of matrix;
+		double kr = ( matrix == kVDFFMatrix_BT709 ) ? 0.2126 : 0.299;
+		double kb = ( matrix == kVDFFMatrix_BT709 ) ? 0.0722 : 0.114;
+		double kg = 1.0 - kr - kb;
+
+		double scaleY = bFullRange ? 1.0 : 255.0 / 219.0;
+		double scaleC = bFullRange ? 1.0 : 255.0 / 224.0;
+		double one = 1 << YUV_COEF_BITS;
+
+		k.yoff	= bFullRange ? 0 : 16;
+		k.cy	= (int)( scaleY * one + 0.5 );
+		k.rv	= (int)( 2.0 * ( 1.0 - kr ) * scaleC * one + 0.5 );
+		k.gu	= (int)( 2.0 * ( 1.0 - kb ) * kb / kg * scaleC * one + 0.5 );
+		k.gv	= (int)( 2.0 * ( 1.0 - kr ) * kr / kg * scaleC * one + 0.5 );
+		k.bu	= (int)( 2.0 * ( 1.0 - kb ) * scaleC * one + 0.5 );
+	}
+
+	inline uint8 clip( int v )
+	{
+		return (uint8)( v < 0 ? 0 : ( v > 255 ? 255 : v ) );
+	}
+
+	template<int bpp>
+	void rowReference( const uint8* pY, const uint8* pU, const uint8* pV, int uvStep, uint8* pDst, int w, const Coeffs& k )
+	{
+		const int round = 1 << ( YUV_COEF_BITS - 1 );
+
+		for ( int x = 0; x < w; ++x )
+		{
+			int y = ( pY[x] - k.yoff ) * k.cy;
+			int u = pU[( x >> 1 ) * uvStep] - 128;
+			int v = pV[( x >> 1 ) * uvStep] - 128;
+
+			pDst[0] = clip( ( y + k.bu * u + round ) >> YUV_COEF_BITS );
+			pDst[1] = clip( ( y - k.gu * u - k.gv * v + round ) >> YUV_COEF_BITS );
+			pDst[2] = clip( ( y + k.rv * v + round ) >> YUV_COEF_BITS );
+			if ( bpp == 4 )
+				pDst[3] = 0xFF;
+			pDst += bpp;
+		}
+	}
+
+	//Pair of 16-bit coefficients for _mm_madd_epi16;
+	inline __m128i coefPair( int lo, int hi )
+	{
+		return _mm_set1_epi32( ( hi << 16 ) | ( lo & 0xFFFF ) );
+	}
+
+	//Eight pixels to two registers of BGRA;
+	inline void pixelsSSE2( const uint8* pY, const uint8* pU, const uint8* pV, int uvStep, const Coeffs& k, __m128i& lo, __m128i& hi )
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi32( 1 << ( YUV_COEF_BITS - 1 ) );
+
+		__m128i y = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)pY ), zero );
+		__m128i u, v;
+
+		if ( uvStep == 2 )
+		{
+			__m128i uv = _mm_loadl_epi64( (const __m128i*)pU );
+			u = _mm_and_si128( uv, _mm_set1_epi16( 0xFF ) );
+			v = _mm_srli_epi16( uv, 8 );
+		}
+		else
+		{
+			u = _mm_unpacklo_epi8( _mm_cvtsi32_si128( *(const int*)pU ), zero );
+			v = _mm_unpacklo_epi8( _mm_cvtsi32_si128( *(const int*)pV ), zero );
+		}
+
+		//Every chroma sample covers two pixels;
+		u = _mm_sub_epi16( _mm_unpacklo_epi16( u, u ), _mm_set1_epi16( 128 ) );
+		v = _mm_sub_epi16( _mm_unpacklo_epi16( v, v ), _mm_set1_epi16( 128 ) );
+		y = _mm_sub_epi16( y, _mm_set1_epi16( (short)k.yoff ) );
+
+		__m128i yuLo = _mm_unpacklo_epi16( y, u );
+		__m128i yuHi = _mm_unpackhi_epi16( y, u );
+		__m128i yvLo = _mm_unpacklo_epi16( y, v );
+		__m128i yvHi = _mm_unpackhi_epi16( y, v );
+		__m128i v0Lo = _mm_unpacklo_epi16( v, zero );
+		__m128i v0Hi = _mm_unpackhi_epi16( v, zero );
+
+		__m128i cyBu = coefPair( k.cy, k.bu );
+		__m128i cyGu = coefPair( k.cy, -k.gu );
+		__m128i gv = coefPair( -k.gv, 0 );
+		__m128i cyRv = coefPair( k.cy, k.rv );
+
+		__m128i b = _mm_packs_epi32(
+			_mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yuLo, cyBu ), round ), YUV_COEF_BITS ),
+			_mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yuHi, cyBu ), round ), YUV_COEF_BITS ) );
+
+		__m128i g = _mm_packs_epi32(
+			_mm_srai_epi32( _mm_add_epi32( _mm_add_epi32( _mm_madd_epi16( yuLo, cyGu ), _mm_madd_epi16( v0Lo, gv ) ), round ), YUV_COEF_BITS ),
+			_mm_srai_epi32( _mm_add_epi32( _mm_add_epi32( _mm_madd_epi16( yuHi, cyGu ), _mm_madd_epi16( v0Hi, gv ) ), round ), YUV_COEF_BITS ) );
+
+		__m128i r = _mm_packs_epi32(
+			_mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yvLo, cyRv ), round ), YUV_COEF_BITS ),
+			_mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yvHi, cyRv ), round ), YUV_COEF_BITS ) );
+
+		b = _mm_packus_epi16( b, b );
+		g = _mm_packus_epi16( g, g );
+		r = _mm_packus_epi16( r, r );
+
+		__m128i bg = _mm_unpacklo_epi8( b, g );
+		__m128i ra = _mm_unpacklo_epi8( r, _mm_set1_epi8( (char)0xFF ) );
+
+		lo = _mm_unpacklo_epi16( bg, ra );
+		hi = _mm_unpackhi_epi16( bg, ra );
+	}
+
+	void row32SSE2( const uint8* pY, const uint8* pU, const uint8* pV, int uvStep, uint8* pDst, int w, const Coeffs& k )
+	{
+		int x = 0;
+		for ( ; x + 8 <= w; x += 8 )
+		{
+			__m128i lo, hi;
+			pixelsSSE2( pY + x, pU + ( x >> 1 ) * uvStep, pV + ( x >> 1 ) * uvStep, uvStep, k, lo, hi );
+			_mm_storeu_si128( (__m128i*)( pDst + x * 4 ), lo );
+			_mm_storeu_si128( (__m128i*)( pDst + x * 4 + 16 ), hi );
+		}
+
+		if ( x < w )
+			rowReference<4>( pY + x, pU + ( x >> 1 ) * uvStep, pV + ( x >> 1 ) * uvStep, uvStep, pDst + x * 4, w - x, k );
+	}
+
+	void row24SSSE3( const uint8* pY, const uint8* pU, const uint8* pV, int uvStep, uint8* pDst, int w, const Coeffs& k )
+	{
+		//Drop alpha, four pixels to twelve bytes;
+		const __m128i pack = _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+
+		int x = 0;
+		for ( ; x + 8 <= w; x += 8 )
+		{
+			__m128i lo, hi;
+			pixelsSSE2( pY + x, pU + ( x >> 1 ) * uvStep, pV + ( x >> 1 ) * uvStep, uvStep, k, lo, hi );
+
+			lo = _mm_shuffle_epi8( lo, pack );
+			hi = _mm_shuffle_epi8( hi, pack );
+
+			_mm_storeu_si128( (__m128i*)( pDst + x * 3 ), _mm_or_si128( lo, _mm_slli_si128( hi, 12 ) ) );
+			_mm_storel_epi64( (__m128i*)( pDst + x * 3 + 16 ), _mm_srli_si128( hi, 4 ) );
+		}
+
+		if ( x < w )
+			rowReference<3>( pY + x, pU + ( x >> 1 ) * uvStep, pV + ( x >> 1 ) * uvStep, uvStep, pDst + x * 3, w - x, k );
+	}
+
+	void reduceReference( const uint16* pSrc, uint8* pDst, int w, int shift, const uint16* pDither )
+	{
+		for ( int x = 0; x < w; ++x )
+		{
+			//Saturates like _mm_adds_epu16;
+			int v = pSrc[x] + pDither[x & 7];
+			if ( v > 0xFFFF )
+				v = 0xFFFF;
+			v >>= shift;
+			pDst[x] = (uint8)( v > 255 ? 255 : v );
+		}
+	}
+
+	void reduceSSE2( const uint16* pSrc, uint8* pDst, int w, int shift, const uint16* pDither )
+	{
+		const __m128i dither = _mm_loadu_si128( (const __m128i*)pDither );
+		const __m128i count = _mm_cvtsi32_si128( shift );
+
+		int x = 0;
+		for ( ; x + 16 <= w; x += 16 )
+		{
+			__m128i a = _mm_adds_epu16( _mm_loadu_si128( (const __m128i*)( pSrc + x ) ), dither );
+			__m128i b = _mm_adds_epu16( _mm_loadu_si128( (const __m128i*)( pSrc + x + 8 ) ), dither );
+
+			a = _mm_srl_epi16( a, count );
+			b = _mm_srl_epi16( b, count );
+
+			_mm_storeu_si128( (__m128i*)( pDst + x ), _mm_packus_epi16( a, b ) );
+		}
+
+		if ( x < w )
+			reduceReference( pSrc + x, pDst + x, w - x, shift, pDither );
+	}
+
+	void reduceRows( TReduceFunc pReduce, const uint8* pSrc, ptrdiff_t pitchSrc, int bits,
+		int w, int h, uint8* pDst, ptrdiff_t pitchDst )
+	{
+		int shift = bits - 8;
+
+		for ( int y = 0; y < h; ++y )
+		{
+			//Thresholds scaled to dropped bits;
+			uint16 dither[8];
+			for ( int x = 0; x < 8; ++x )
+			{
+				int t = kDither8x8[y & 7][x];
+				dither[x] = (uint16)( shift <= 6 ? t >> ( 6 - shift ) : t << ( shift - 6 ) );
+			}
+
+			pReduce( (const uint16*)( pSrc + y * pitchSrc ), pDst + y * pitchDst, w, shift, dither );
+		}
+	}
+
+	void convertRows( TRowFunc pRow, const VDFFYUVPlanes& src, int layout, int matrix, bool bFullRange,
+		int w, int h, void* pDst, ptrdiff_t pitchDst )
+	{
+		Coeffs k;
+		setupCoeffs( k, matrix, bFullRange );
+
+		int uvStep = ( layout == kVDFFLayout_NV12 ) ? 2 : 1;
+		const uint8* pV = ( layout == kVDFFLayout_NV12 ) ? src.pU + 1 : src.pV;
+
+		for ( int y = 0; y < h; ++y )
+		{
+			ptrdiff_t offsetUV = ( y >> 1 ) * src.pitchUV;
+			pRow( src.pY + y * src.pitchY, src.pU + offsetUV, pV + offsetUV, uvStep,
+				(uint8*)pDst + y * pitchDst, w, k );
+		}
+	}
+}
+
+bool VDFFConvertYUVToRGB( const VDFFYUVPlanes& src, int layout, int matrix, bool bFullRange,
+	int w, int h, void* pDst, ptrdiff_t pitchDst, int bytesPerPixel )
+{
+	TRowFunc pRow = NULL;
+	int features = cpuFeatures();
+
+	if ( bytesPerPixel == 4 && ( features & kCpuSSE2 ) )
+		pRow = row32SSE2;
+	else if ( bytesPerPixel == 3 && ( features & kCpuSSSE3 ) )
+		pRow = row24SSSE3;
+
+	if ( !pRow )
+		return false;
+
+	convertRows( pRow, src, layout, matrix, bFullRange, w, h, pDst, pitchDst );
+	return true;
+}
+
+void VDFFConvertYUVToRGBReference( const VDFFYUVPlanes& src, int layout, int matrix, bool bFullRange,
+	int w, int h, void* pDst, ptrdiff_t pitchDst, int bytesPerPixel )
+{
+	convertRows( bytesPerPixel == 4 ? rowReference<4> : rowReference<3>,
+		src, layout, matrix, bFullRange, w, h, pDst, pitchDst );
+}
+
+void VDFFReducePlane( const uint8* pSrc, ptrdiff_t pitchSrc, int bits,
+	int w, int h, uint8* pDst, ptrdiff_t pitchDst )
+{
+	TReduceFunc pReduce = ( cpuFeatures() & kCpuSSE2 ) ? reduceSSE2 : reduceReference;
+
+	reduceRows( pReduce, pSrc, pitchSrc, bits, w, h, pDst, pitchDst );
+}
+
+void VDFFReducePlaneReference( const uint8* pSrc, ptrdiff_t pitchSrc, int bits,
+	int w, int h, uint8* pDst, ptrdiff_t pitchDst )
+{
+	reduceRows( reduceReference, pSrc, pitchSrc, bits, w, h, pDst, pitchDst );
+}